@@ -1 +1,745 @@
 #include "FMeshQuadTreeGPU.h"
+#include "DataDrivenShaderPlatformInfo.h"
+#include "GlobalShader.h"
+#include "HitProxies.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+
+/** Values of ETraversalMode for the modes the kernels use, checked in BuildNodes */
+static constexpr uint32 TraversalModeSelectLOD = 0;
+static constexpr uint32 TraversalModeSelectLODRefinement = 1;
+
+/** Size in bytes of FQuadtreeMeshTraversalItem in the shader */
+static constexpr uint32 TraversalItemSize = 5 * sizeof(uint32);
+
+BEGIN_SHADER_PARAMETER_STRUCT(FQuadtreeMeshTraversalParameters, )
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint4>, Nodes)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, RenderData)
+	SHADER_PARAMETER_ARRAY(FVector4f, Planes, [FMeshQuadTreeGPU::MaxPlanes])
+	SHADER_PARAMETER_ARRAY(FVector4f, PackedSquaredLODDistances, [FMeshQuadTreeGPU::MaxLODs / 4])
+	SHADER_PARAMETER(FVector4f, LODRegion)
+	SHADER_PARAMETER(float, ZStep)
+	SHADER_PARAMETER(float, HeightMorph)
+	SHADER_PARAMETER(uint32, NumPlanes)
+	SHADER_PARAMETER(uint32, bLODMorphingEnabled)
+	SHADER_PARAMETER(int32, LowestLOD)
+	SHADER_PARAMETER(int32, DensityCount)
+	SHADER_PARAMETER(int32, ForceCollapseDensityLevel)
+	SHADER_PARAMETER(int32, MinDensityLevel)
+	SHADER_PARAMETER(int32, LODBias)
+	SHADER_PARAMETER(uint32, TreeDepth)
+	SHADER_PARAMETER(uint32, NumBuckets)
+	SHADER_PARAMETER(uint32, BucketCapacity)
+	SHADER_PARAMETER(uint32, ItemCapacity)
+END_SHADER_PARAMETER_STRUCT()
+
+class FQuadtreeMeshTraversalShader : public FGlobalShader
+{
+public:
+	static constexpr uint32 ThreadGroupSize = 64;
+
+	FQuadtreeMeshTraversalShader() = default;
+	FQuadtreeMeshTraversalShader(const ShaderMetaType::CompiledShaderInitializerType& Initializer) : FGlobalShader(Initializer) {}
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+		OutEnvironment.SetDefine(TEXT("QUADTREE_MESH_MAX_PLANES"), FMeshQuadTreeGPU::MaxPlanes);
+		OutEnvironment.SetDefine(TEXT("QUADTREE_MESH_MAX_LODS"), FMeshQuadTreeGPU::MaxLODs);
+	}
+};
+
+/** Culls the root and writes it as the only item of the first pass */
+class FQuadtreeMeshTraversalInitCS : public FQuadtreeMeshTraversalShader
+{
+	DECLARE_GLOBAL_SHADER(FQuadtreeMeshTraversalInitCS);
+	SHADER_USE_PARAMETER_STRUCT(FQuadtreeMeshTraversalInitCS, FQuadtreeMeshTraversalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FQuadtreeMeshTraversalParameters, Traversal)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FQuadtreeMeshTraversalItem>, OutItems)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, ItemCounts)
+	END_SHADER_PARAMETER_STRUCT()
+};
+IMPLEMENT_GLOBAL_SHADER(FQuadtreeMeshTraversalInitCS, "/Plugin/QuadtreeMesh/Private/QuadtreeMeshTraversal.usf", "InitTraversalCS", SF_Compute);
+
+/** Indirect dispatch arguments of a pass from the number of items the previous one pushed */
+class FQuadtreeMeshTraversalDispatchArgsCS : public FQuadtreeMeshTraversalShader
+{
+	DECLARE_GLOBAL_SHADER(FQuadtreeMeshTraversalDispatchArgsCS);
+	SHADER_USE_PARAMETER_STRUCT(FQuadtreeMeshTraversalDispatchArgsCS, FQuadtreeMeshTraversalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FQuadtreeMeshTraversalParameters, Traversal)
+		SHADER_PARAMETER(uint32, Pass)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, ItemCounts)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, DispatchArgs)
+	END_SHADER_PARAMETER_STRUCT()
+};
+IMPLEMENT_GLOBAL_SHADER(FQuadtreeMeshTraversalDispatchArgsCS, "/Plugin/QuadtreeMesh/Private/QuadtreeMeshTraversal.usf", "BuildDispatchArgsCS", SF_Compute);
+
+/** One thread per item of the pass, same as one iteration of FTraversalContext::Traverse */
+class FQuadtreeMeshTraversalCS : public FQuadtreeMeshTraversalShader
+{
+	DECLARE_GLOBAL_SHADER(FQuadtreeMeshTraversalCS);
+	SHADER_USE_PARAMETER_STRUCT(FQuadtreeMeshTraversalCS, FQuadtreeMeshTraversalShader);
+
+	/** Writes the hit proxy stream, only the editor binds it */
+	class FHitProxyStream : SHADER_PERMUTATION_BOOL("QUADTREE_MESH_HIT_PROXY_STREAM");
+	using FPermutationDomain = TShaderPermutationDomain<FHitProxyStream>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FQuadtreeMeshTraversalParameters, Traversal)
+		SHADER_PARAMETER(uint32, Pass)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FQuadtreeMeshTraversalItem>, InItems)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FQuadtreeMeshTraversalItem>, OutItems)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, ItemCounts)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, BucketCounts)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<float4>, OutInstanceData0)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<float4>, OutInstanceData1)
+		RDG_BUFFER_ACCESS(IndirectDispatchArgs, ERHIAccess::IndirectArgs)
+	END_SHADER_PARAMETER_STRUCT()
+};
+IMPLEMENT_GLOBAL_SHADER(FQuadtreeMeshTraversalCS, "/Plugin/QuadtreeMesh/Private/QuadtreeMeshTraversal.usf", "TraverseCS", SF_Compute);
+
+/** One FRHIDrawIndexedIndirectParameters per bucket */
+class FQuadtreeMeshTraversalDrawArgsCS : public FQuadtreeMeshTraversalShader
+{
+	DECLARE_GLOBAL_SHADER(FQuadtreeMeshTraversalDrawArgsCS);
+	SHADER_USE_PARAMETER_STRUCT(FQuadtreeMeshTraversalDrawArgsCS, FQuadtreeMeshTraversalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FQuadtreeMeshTraversalParameters, Traversal)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, BucketIndexCounts)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, BucketCounts)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, DrawArgs)
+	END_SHADER_PARAMETER_STRUCT()
+};
+IMPLEMENT_GLOBAL_SHADER(FQuadtreeMeshTraversalDrawArgsCS, "/Plugin/QuadtreeMesh/Private/QuadtreeMeshTraversal.usf", "BuildDrawArgsCS", SF_Compute);
+
+/**
+ *	QuadtreeMeshTraversal.usf on the CPU, function for function. Threads run one after the other in thread order, which is one of the orders the GPU can run them in.
+ *	Float math is scalar with one rounding per operation, like the precise expressions of the kernels and the SSE path of CullItems4.
+ */
+struct FQuadtreeMeshTraversalEmulation
+{
+	/** FQuadtreeMeshNode */
+	struct FNode
+	{
+		uint32 TileX;
+		uint32 TileY;
+		uint32 FirstChild;
+		uint32 QuadtreeMeshIndex;
+		uint32 Level;
+		uint32 ChildMask;
+		bool bHasCompleteSubtree;
+		bool bIsSubtreeSameQuadtreeMesh;
+		uint32 QuantizedMinZ;
+		uint32 QuantizedMaxZ;
+	};
+
+	/** FTraversalItem */
+	struct FItem
+	{
+		uint32 NodeIndex;
+		uint32 TileX;
+		uint32 TileY;
+		uint32 Level;
+		uint32 LODLevel;
+		uint32 DensityLevel;
+		uint32 Mode;
+		uint32 PlaneMask;
+		float SquaredDistance;
+	};
+
+	FQuadtreeMeshTraversalEmulation(const TArray<FUintVector4>& InNodes, const FMeshQuadTreeGPU::FTraverseParams& InParams, FMeshQuadTree::FTraversalOutput& InOutput)
+		: Nodes(InNodes)
+		, Params(InParams)
+		, Output(InOutput)
+	{
+		BucketCounts.SetNumZeroed(InParams.NumBuckets);
+	}
+
+	FNode LoadNode(uint32 InNodeIndex) const
+	{
+		const FUintVector4& Packed = Nodes[InNodeIndex];
+		FNode Node;
+		Node.TileX = Packed.X & 0xFFFF;
+		Node.TileY = Packed.X >> 16;
+		Node.FirstChild = Packed.Y;
+		Node.QuadtreeMeshIndex = Packed.Z & 0xFFFF;
+		Node.Level = (Packed.Z >> 16) & 0x1F;
+		Node.ChildMask = (Packed.Z >> 21) & 0xF;
+		Node.bHasCompleteSubtree = ((Packed.Z >> 25) & 1) != 0;
+		Node.bIsSubtreeSameQuadtreeMesh = ((Packed.Z >> 26) & 1) != 0;
+		Node.QuantizedMinZ = Packed.W & 0x3FF;
+		Node.QuantizedMaxZ = (Packed.W >> 10) & 0x3FF;
+		return Node;
+	}
+
+	bool CanRender(const FNode& InNode, int32 InDensityLevel) const
+	{
+		const bool bHasMaterial = Params.RenderData[2 * InNode.QuadtreeMeshIndex].Y != 0.0f;
+		return bHasMaterial && InNode.bIsSubtreeSameQuadtreeMesh && ((InDensityLevel > Params.ForceCollapseDensityLevel) || InNode.bHasCompleteSubtree);
+	}
+
+	bool CullItem(FItem& InOutItem, const FNode& InNode, uint32 InParentPlaneMask, bool bInComputeDistance) const
+	{
+		const float MinX = static_cast<float>(InOutItem.TileX);
+		const float MinY = static_cast<float>(InOutItem.TileY);
+		const float Size = static_cast<float>(1u << InOutItem.Level);
+		const float BoxMinZ = static_cast<float>(InNode.QuantizedMinZ) * Params.ZStep;
+		const float BoxMaxZ = static_cast<float>(InNode.QuantizedMaxZ) * Params.ZStep;
+		const float ExtentXY = Size * 0.5f;
+		const float ExtentZ = (BoxMaxZ - BoxMinZ) * 0.5f;
+		const float CenterX = MinX + ExtentXY;
+		const float CenterY = MinY + ExtentXY;
+		const float CenterZ = (BoxMinZ + BoxMaxZ) * 0.5f;
+
+		bool bOutside = false;
+		InOutItem.PlaneMask = InParentPlaneMask;
+		for (uint32 PlaneMask = InParentPlaneMask; PlaneMask != 0; PlaneMask &= PlaneMask - 1)
+		{
+			const uint32 PlaneIndex = FMath::CountTrailingZeros(PlaneMask);
+			const FVector4f& Plane = Params.Planes[PlaneIndex];
+			const float Distance = (CenterZ * Plane.Z + (CenterY * Plane.Y + CenterX * Plane.X)) - Plane.W;
+			const float PushOut = ExtentZ * FMath::Abs(Plane.Z) + ExtentXY * (FMath::Abs(Plane.X) + FMath::Abs(Plane.Y));
+			bOutside |= (Distance > PushOut);
+			if (-PushOut > Distance)
+			{
+				InOutItem.PlaneMask &= ~(1u << PlaneIndex);
+			}
+		}
+
+		InOutItem.SquaredDistance = 0.0f;
+		if (bInComputeDistance)
+		{
+			const float DistanceX = FMath::Max(FMath::Max(MinX - Params.LODRegion.Max.X, Params.LODRegion.Min.X - (MinX + Size)), 0.0f);
+			const float DistanceY = FMath::Max(FMath::Max(MinY - Params.LODRegion.Max.Y, Params.LODRegion.Min.Y - (MinY + Size)), 0.0f);
+			InOutItem.SquaredDistance = DistanceX * DistanceX + DistanceY * DistanceY;
+		}
+		return !bOutside;
+	}
+
+	void AppendItem(const FItem& InItem)
+	{
+		if (NextItems.Num() < Params.ItemCapacity)
+		{
+			NextItems.Add(InItem);
+		}
+	}
+
+	void PushVisibleChildren(const FItem& InParent, const FNode& InParentNode, bool bInAllowImplicit, uint32 InMode, uint32 InLODLevel, uint32 InDensityLevel)
+	{
+		const bool bImplicit = bInAllowImplicit && InParentNode.bHasCompleteSubtree && InParentNode.bIsSubtreeSameQuadtreeMesh;
+		if (!bImplicit && InParent.Level != InParentNode.Level)
+		{
+			return;
+		}
+
+		const uint32 ChildCount = bImplicit ? 4 : static_cast<uint32>(FMath::CountBits(InParentNode.ChildMask));
+		for (uint32 ChildIndex = 0; ChildIndex < ChildCount; ++ChildIndex)
+		{
+			FItem Child;
+			FNode ChildNode;
+			if (bImplicit)
+			{
+				const uint32 ChildSize = 1u << (InParent.Level - 1);
+				Child.NodeIndex = InParent.NodeIndex;
+				Child.TileX = InParent.TileX + (ChildIndex & 1) * ChildSize;
+				Child.TileY = InParent.TileY + (ChildIndex >> 1) * ChildSize;
+				Child.Level = InParent.Level - 1;
+				ChildNode = InParentNode;
+			}
+			else
+			{
+				Child.NodeIndex = InParentNode.FirstChild + ChildIndex;
+				ChildNode = LoadNode(Child.NodeIndex);
+				Child.TileX = ChildNode.TileX;
+				Child.TileY = ChildNode.TileY;
+				Child.Level = ChildNode.Level;
+			}
+			Child.LODLevel = InLODLevel;
+			Child.DensityLevel = InDensityLevel;
+			Child.Mode = InMode;
+
+			if (CullItem(Child, ChildNode, InParent.PlaneMask, InMode == TraversalModeSelectLOD))
+			{
+				AppendItem(Child);
+			}
+		}
+	}
+
+	void AddNodeForRender(const FItem& InItem, const FNode& InNode, int32 InDensityLevel, int32 InLODLevel)
+	{
+		// Single material, see FTraversalContext::AddNodeForRender
+		const int32 DensityIndex = FMath::Clamp(InDensityLevel, Params.MinDensityLevel, Params.DensityCount - 1);
+		const int32 BucketIndex = DensityIndex;
+
+		const uint32 InstanceIndex = BucketCounts[BucketIndex]++;
+		if (InstanceIndex >= static_cast<uint32>(Params.BucketCapacity))
+		{
+			return;
+		}
+
+		const FVector4f& RenderData0 = Params.RenderData[2 * InNode.QuadtreeMeshIndex];
+
+		const bool bIsLowestLOD = (InLODLevel == Params.LowestLOD);
+		const uint32 bShouldMorph = (Params.bLODMorphingEnabled && (DensityIndex != Params.DensityCount - 1)) ? 1 : 0;
+		const uint32 bCanMorphTwice = (DensityIndex < Params.DensityCount - 2) ? 1 : 0;
+		const uint32 BitPackedChannel = (static_cast<uint32>(InLODLevel) & 0xFF) | (bShouldMorph << 8) | (bCanMorphTwice << 9) | ((InItem.Level & 0x1F) << 10)
+			| ((static_cast<uint32>(Params.LODBias) & 0xFF) << 16) | (2u << 24);
+
+		FMeshQuadTree::FBucketInstanceData& Bucket = Output.BucketInstanceData[BucketIndex];
+		Bucket.Streams[0].Add(FVector4f(std::bit_cast<float>(InItem.TileX | (InItem.TileY << 16)), RenderData0.X, std::bit_cast<float>(BitPackedChannel), bIsLowestLOD ? Params.HeightMorph : 0.0f));
+#if WITH_EDITOR
+		const FVector4f& RenderData1 = Params.RenderData[2 * InNode.QuadtreeMeshIndex + 1];
+		Bucket.Streams[1].Add(FVector4f(RenderData1.X, RenderData1.Y, RenderData1.Z, RenderData0.Z));
+#endif
+
+		++Output.BucketInstanceCounts[BucketIndex];
+		++Output.InstanceCount;
+	}
+
+	/** TraverseCS */
+	void TraverseItem(const FItem& InItem)
+	{
+		const FNode Node = LoadNode(InItem.NodeIndex);
+		const uint32 LODLevel = InItem.LODLevel;
+
+		if (InItem.Mode == TraversalModeSelectLOD)
+		{
+			if (InItem.SquaredDistance > Params.SquaredLODDistances[LODLevel])
+			{
+				if (CanRender(Node, 0))
+				{
+					AddNodeForRender(InItem, Node, 1, LODLevel + 1);
+				}
+				else
+				{
+					PushVisibleChildren(InItem, Node, false, TraversalModeSelectLODRefinement, LODLevel + 1, 2);
+				}
+			}
+			else if (LODLevel == 0)
+			{
+				if (CanRender(Node, 0))
+				{
+					AddNodeForRender(InItem, Node, 0, LODLevel);
+				}
+			}
+			else if (InItem.SquaredDistance > Params.SquaredLODDistances[LODLevel - 1] || static_cast<int32>(LODLevel) == Params.LowestLOD)
+			{
+				if (CanRender(Node, 0))
+				{
+					AddNodeForRender(InItem, Node, 0, LODLevel);
+				}
+				else
+				{
+					PushVisibleChildren(InItem, Node, false, TraversalModeSelectLODRefinement, LODLevel, 1);
+				}
+			}
+			else
+			{
+				PushVisibleChildren(InItem, Node, true, TraversalModeSelectLOD, LODLevel - 1, 0);
+			}
+		}
+		else if (CanRender(Node, static_cast<int32>(InItem.DensityLevel)))
+		{
+			AddNodeForRender(InItem, Node, static_cast<int32>(InItem.DensityLevel), LODLevel);
+		}
+		else
+		{
+			PushVisibleChildren(InItem, Node, false, TraversalModeSelectLODRefinement, LODLevel, InItem.DensityLevel + 1);
+		}
+	}
+
+	/** InitTraversalCS, then the passes */
+	void Run()
+	{
+		const uint32 AllPlanesMask = (Params.Planes.Num() < 32) ? (1u << Params.Planes.Num()) - 1 : ~0u;
+		const FNode RootNode = LoadNode(0);
+		FItem RootItem = { 0, RootNode.TileX, RootNode.TileY, RootNode.Level, static_cast<uint32>(Params.TreeDepth), 0, TraversalModeSelectLOD, 0, 0.0f };
+		if (Params.ItemCapacity > 0 && CullItem(RootItem, RootNode, AllPlanesMask, true))
+		{
+			Items.Add(RootItem);
+		}
+
+		for (int32 Pass = 0; Pass <= Params.TreeDepth && Items.Num() > 0; ++Pass)
+		{
+			NextItems.Reset();
+			for (const FItem& Item : Items)
+			{
+				TraverseItem(Item);
+			}
+			Swap(Items, NextItems);
+		}
+	}
+
+	const TArray<FUintVector4>& Nodes;
+	const FMeshQuadTreeGPU::FTraverseParams& Params;
+	FMeshQuadTree::FTraversalOutput& Output;
+
+	/** Items of the current pass and the items it pushes */
+	TArray<FItem> Items;
+	TArray<FItem> NextItems;
+
+	/** Instances added per bucket, including the ones past BucketCapacity */
+	TArray<uint32> BucketCounts;
+};
+
+bool FMeshQuadTreeGPU::MakeGPUTraversalDesc(FMeshQuadTree::FTraversalDesc& InOutTraversalDesc)
+{
+	// Footprint and horizon culling only cull more, budgets and the analytic regions only change how tiles are selected, not which tiles the LOD distances select
+	InOutTraversalDesc.bFootprintCulling = false;
+	InOutTraversalDesc.HorizonOccluders.Reset();
+	InOutTraversalDesc.bAnalyticCompleteRegions = false;
+	InOutTraversalDesc.InstanceBudget = 0;
+	InOutTraversalDesc.VertexBudget = 0;
+	InOutTraversalDesc.bSortFrontToBack = false;
+	InOutTraversalDesc.ParallelSplitDepth = 0;
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+	InOutTraversalDesc.DebugPDI = nullptr;
+#endif
+
+	// Shared traversals are culled against the footprint of their union only
+	return InOutTraversalDesc.UnionFrusta.Num() == 0 && InOutTraversalDesc.Frustum.Planes.Num() <= MaxPlanes;
+}
+
+void FMeshQuadTreeGPU::BuildTraverseParams(const FMeshQuadTree& InTree, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, int32 InBucketCapacity, FTraverseParams& OutParams)
+{
+	static_assert(FMeshQuadTree::MaxTreeDepth + 1 <= MaxLODs, "The LOD distances of the deepest tree don't fit in the shader parameters");
+
+	// The context converts the desc to tile space in double precision, the kernels start from its float results
+	const FMeshQuadTree::FTraversalContext Context(InTree, InTraversalDesc);
+	check(Context.FootprintPlanesMask == 0 && Context.HorizonBins.Num() == 0 && Context.PlaneVectors.Num() <= MaxPlanes);
+
+	OutParams.Planes.Reset();
+	for (const FMeshQuadTree::FTraversalContext::FPlaneVectors& Plane : Context.PlaneVectors)
+	{
+		OutParams.Planes.Add(FVector4f(VectorGetComponent(Plane.X, 0), VectorGetComponent(Plane.Y, 0), VectorGetComponent(Plane.Z, 0), VectorGetComponent(Plane.W, 0)));
+	}
+
+	OutParams.SquaredLODDistances.Reset();
+	OutParams.SquaredLODDistances.Append(Context.SquaredLODDistances);
+
+	bool bHasHitProxies = false;
+#if WITH_EDITOR
+	for (const FQuadtreeMeshRenderData& QuadtreeMeshRenderData : InTree.NodeData.QuadtreeMeshRenderData)
+	{
+		bHasHitProxies |= QuadtreeMeshRenderData.HitProxy.IsValid();
+	}
+#endif
+
+	OutParams.RenderData.Reset(2 * InTree.NodeData.QuadtreeMeshRenderData.Num());
+	for (const FQuadtreeMeshRenderData& QuadtreeMeshRenderData : InTree.NodeData.QuadtreeMeshRenderData)
+	{
+		// Same conversions as AddNodeForRender
+		const float BaseHeight = static_cast<float>(QuadtreeMeshRenderData.SurfaceBaseHeight - Context.MinZ);
+		OutParams.RenderData.Add(FVector4f(BaseHeight, QuadtreeMeshRenderData.Material ? 1.0f : 0.0f, QuadtreeMeshRenderData.bQuadtreeMeshSelected ? 1.0f : 0.0f, 0.0f));
+
+		const FLinearColor HitProxyColor = (bHasHitProxies && QuadtreeMeshRenderData.HitProxy) ? QuadtreeMeshRenderData.HitProxy->Id.GetColor().ReinterpretAsLinear() : FLinearColor::Black;
+		OutParams.RenderData.Add(FVector4f(HitProxyColor.R, HitProxyColor.G, HitProxyColor.B, 0.0f));
+	}
+
+	OutParams.LODRegion = Context.LODRegion;
+	OutParams.ZStep = Context.ZStep;
+
+	OutParams.TreeDepth = Context.TreeDepth;
+	OutParams.LowestLOD = InTraversalDesc.LowestLOD;
+	OutParams.DensityCount = InTraversalDesc.DensityCount;
+	OutParams.ForceCollapseDensityLevel = InTraversalDesc.ForceCollapseDensityLevel;
+	OutParams.MinDensityLevel = InTraversalDesc.MinDensityLevel;
+	OutParams.LODBias = InTraversalDesc.LODBias;
+	OutParams.HeightMorph = InTraversalDesc.HeightMorph;
+	OutParams.bLODMorphingEnabled = InTraversalDesc.bLODMorphingEnabled;
+
+	OutParams.NumBuckets = InTree.GetQuadtreeMeshMaterials().Num() * InTraversalDesc.DensityCount;
+	OutParams.BucketCapacity = InBucketCapacity;
+	// A pass rarely holds more items than all the buckets together hold instances
+	OutParams.ItemCapacity = OutParams.NumBuckets * InBucketCapacity;
+}
+
+void FMeshQuadTreeGPU::BuildNodes(const FMeshQuadTree& InTree, TArray<FUintVector4>& OutNodes)
+{
+	static_assert(static_cast<uint32>(FMeshQuadTree::ETraversalMode::SelectLOD) == TraversalModeSelectLOD
+		&& static_cast<uint32>(FMeshQuadTree::ETraversalMode::SelectLODRefinement) == TraversalModeSelectLODRefinement, "The kernels use the values of ETraversalMode");
+	static_assert(sizeof(FMeshQuadTree::FTraversalItem) == TraversalItemSize, "FQuadtreeMeshTraversalItem is expected to be as compact as FTraversalItem");
+
+	OutNodes.Reset(InTree.NodeData.Nodes.Num());
+	for (const FMeshQuadTree::FNode& Node : InTree.NodeData.Nodes)
+	{
+		OutNodes.Add(FUintVector4(
+			static_cast<uint32>(Node.TileX) | (static_cast<uint32>(Node.TileY) << 16),
+			Node.FirstChild,
+			static_cast<uint32>(Node.QuadtreeMeshIndex) | (Node.Level << 16) | (Node.ChildMask << 21) | (Node.HasCompleteSubtree << 25) | (Node.IsSubtreeSameQuadtreeMesh << 26),
+			Node.QuantizedMinZ | (Node.QuantizedMaxZ << 10)));
+	}
+}
+
+FMeshQuadTreeGPU::FTraversalResult FMeshQuadTreeGPU::Traverse(FRDGBuilder& GraphBuilder, const FMeshQuadTree& InTree, const FTraverseParams& InParams, const TArray<uint32>& InBucketIndexCounts, uint32 InFrameNumber)
+{
+	check(IsInRenderingThread());
+	check(InBucketIndexCounts.Num() == InParams.NumBuckets && InParams.Planes.Num() <= MaxPlanes && InParams.SquaredLODDistances.Num() <= MaxLODs);
+	RDG_EVENT_SCOPE(GraphBuilder, "QuadtreeMeshTraversal");
+
+	// The tree is read-only once the proxy has it
+	if (!NodesBuffer.IsValid())
+	{
+		TArray<FUintVector4> Nodes;
+		BuildNodes(InTree, Nodes);
+		NodesBuffer = GraphBuilder.ConvertToExternalBuffer(CreateStructuredBuffer(GraphBuilder, TEXT("QuadtreeMesh.Nodes"), Nodes));
+	}
+
+	// The draws of this frame reference the buffers of its traversals, they are only reused by the next frame
+	if (InFrameNumber != FrameNumber)
+	{
+		FrameNumber = InFrameNumber;
+		NumUsedTraversalBuffers = 0;
+	}
+	if (NumUsedTraversalBuffers == TraversalBuffers.Num())
+	{
+		TraversalBuffers.AddDefaulted();
+	}
+	FTraversalBuffers& Buffers = TraversalBuffers[NumUsedTraversalBuffers++];
+	if (Buffers.NumBuckets != InParams.NumBuckets || Buffers.BucketCapacity != InParams.BucketCapacity)
+	{
+		FRDGBufferDesc InstanceBufferDesc = FRDGBufferDesc::CreateBufferDesc(sizeof(FVector4f), InParams.NumBuckets * InParams.BucketCapacity);
+		InstanceBufferDesc.Usage |= EBufferUsageFlags::VertexBuffer;
+		for (TRefCountPtr<FRDGPooledBuffer>& InstanceBuffer : Buffers.InstanceBuffers)
+		{
+			InstanceBuffer = AllocatePooledBuffer(InstanceBufferDesc, TEXT("QuadtreeMesh.InstanceData"));
+		}
+		Buffers.IndirectArgsBuffer = AllocatePooledBuffer(FRDGBufferDesc::CreateIndirectDesc<FRHIDrawIndexedIndirectParameters>(InParams.NumBuckets), TEXT("QuadtreeMesh.DrawArgs"));
+		Buffers.NumBuckets = InParams.NumBuckets;
+		Buffers.BucketCapacity = InParams.BucketCapacity;
+	}
+
+	const int32 NumPasses = InParams.TreeDepth + 1;
+	FRDGBufferRef Items[2] =
+	{
+		GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(TraversalItemSize, InParams.ItemCapacity), TEXT("QuadtreeMesh.TraversalItems")),
+		GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(TraversalItemSize, InParams.ItemCapacity), TEXT("QuadtreeMesh.TraversalItems")),
+	};
+	FRDGBufferRef ItemCounts = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), NumPasses + 1), TEXT("QuadtreeMesh.ItemCounts"));
+	FRDGBufferRef BucketCounts = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), InParams.NumBuckets), TEXT("QuadtreeMesh.BucketCounts"));
+	FRDGBufferRef DispatchArgs = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateIndirectDesc<FRHIDispatchIndirectParameters>(NumPasses), TEXT("QuadtreeMesh.DispatchArgs"));
+	FRDGBufferRef BucketIndexCounts = CreateStructuredBuffer(GraphBuilder, TEXT("QuadtreeMesh.BucketIndexCounts"), InBucketIndexCounts);
+
+	FRDGBufferRef InstanceBuffers[FMeshQuadTree::NumStreams];
+	FRDGBufferUAVRef InstanceBufferUAVs[FMeshQuadTree::NumStreams];
+	for (int32 StreamIndex = 0; StreamIndex < FMeshQuadTree::NumStreams; ++StreamIndex)
+	{
+		InstanceBuffers[StreamIndex] = GraphBuilder.RegisterExternalBuffer(Buffers.InstanceBuffers[StreamIndex]);
+		InstanceBufferUAVs[StreamIndex] = GraphBuilder.CreateUAV(InstanceBuffers[StreamIndex], PF_A32B32G32R32F);
+	}
+	FRDGBufferRef IndirectArgs = GraphBuilder.RegisterExternalBuffer(Buffers.IndirectArgsBuffer);
+
+	FQuadtreeMeshTraversalParameters TraversalParameters;
+	TraversalParameters.Nodes = GraphBuilder.CreateSRV(GraphBuilder.RegisterExternalBuffer(NodesBuffer));
+	TraversalParameters.RenderData = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("QuadtreeMesh.RenderData"), InParams.RenderData));
+	for (int32 PlaneIndex = 0; PlaneIndex < InParams.Planes.Num(); ++PlaneIndex)
+	{
+		TraversalParameters.Planes[PlaneIndex] = InParams.Planes[PlaneIndex];
+	}
+	for (int32 LODLevel = 0; LODLevel < InParams.SquaredLODDistances.Num(); ++LODLevel)
+	{
+		TraversalParameters.PackedSquaredLODDistances[LODLevel >> 2][LODLevel & 3] = InParams.SquaredLODDistances[LODLevel];
+	}
+	TraversalParameters.LODRegion = FVector4f(InParams.LODRegion.Min.X, InParams.LODRegion.Min.Y, InParams.LODRegion.Max.X, InParams.LODRegion.Max.Y);
+	TraversalParameters.ZStep = InParams.ZStep;
+	TraversalParameters.HeightMorph = InParams.HeightMorph;
+	TraversalParameters.NumPlanes = InParams.Planes.Num();
+	TraversalParameters.bLODMorphingEnabled = InParams.bLODMorphingEnabled ? 1 : 0;
+	TraversalParameters.LowestLOD = InParams.LowestLOD;
+	TraversalParameters.DensityCount = InParams.DensityCount;
+	TraversalParameters.ForceCollapseDensityLevel = InParams.ForceCollapseDensityLevel;
+	TraversalParameters.MinDensityLevel = InParams.MinDensityLevel;
+	TraversalParameters.LODBias = InParams.LODBias;
+	TraversalParameters.TreeDepth = InParams.TreeDepth;
+	TraversalParameters.NumBuckets = InParams.NumBuckets;
+	TraversalParameters.BucketCapacity = InParams.BucketCapacity;
+	TraversalParameters.ItemCapacity = InParams.ItemCapacity;
+
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
+	FRDGBufferUAVRef ItemCountsUAV = GraphBuilder.CreateUAV(ItemCounts, PF_R32_UINT);
+	FRDGBufferUAVRef BucketCountsUAV = GraphBuilder.CreateUAV(BucketCounts, PF_R32_UINT);
+	AddClearUAVPass(GraphBuilder, ItemCountsUAV, 0u);
+	AddClearUAVPass(GraphBuilder, BucketCountsUAV, 0u);
+
+	{
+		FQuadtreeMeshTraversalInitCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FQuadtreeMeshTraversalInitCS::FParameters>();
+		PassParameters->Traversal = TraversalParameters;
+		PassParameters->OutItems = GraphBuilder.CreateUAV(Items[0]);
+		PassParameters->ItemCounts = ItemCountsUAV;
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Init"), TShaderMapRef<FQuadtreeMeshTraversalInitCS>(ShaderMap), PassParameters, FIntVector(1, 1, 1));
+	}
+
+	// The items of a pass are one level below the items of the previous one, so the depth of the tree bounds the number of passes
+	for (int32 Pass = 0; Pass < NumPasses; ++Pass)
+	{
+		{
+			FQuadtreeMeshTraversalDispatchArgsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FQuadtreeMeshTraversalDispatchArgsCS::FParameters>();
+			PassParameters->Traversal = TraversalParameters;
+			PassParameters->Pass = Pass;
+			PassParameters->ItemCounts = ItemCountsUAV;
+			PassParameters->DispatchArgs = GraphBuilder.CreateUAV(DispatchArgs, PF_R32_UINT);
+			FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("DispatchArgs (Pass %d)", Pass), TShaderMapRef<FQuadtreeMeshTraversalDispatchArgsCS>(ShaderMap), PassParameters, FIntVector(1, 1, 1));
+		}
+
+		FQuadtreeMeshTraversalCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FQuadtreeMeshTraversalCS::FParameters>();
+		PassParameters->Traversal = TraversalParameters;
+		PassParameters->Pass = Pass;
+		PassParameters->InItems = GraphBuilder.CreateSRV(Items[Pass & 1]);
+		PassParameters->OutItems = GraphBuilder.CreateUAV(Items[(Pass + 1) & 1]);
+		PassParameters->ItemCounts = ItemCountsUAV;
+		PassParameters->BucketCounts = BucketCountsUAV;
+		PassParameters->OutInstanceData0 = InstanceBufferUAVs[0];
+#if WITH_EDITOR
+		PassParameters->OutInstanceData1 = InstanceBufferUAVs[1];
+#endif
+		PassParameters->IndirectDispatchArgs = DispatchArgs;
+
+		FQuadtreeMeshTraversalCS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FQuadtreeMeshTraversalCS::FHitProxyStream>(FMeshQuadTree::NumStreams > 1);
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("Traverse (Pass %d)", Pass), TShaderMapRef<FQuadtreeMeshTraversalCS>(ShaderMap, PermutationVector), PassParameters, DispatchArgs, Pass * sizeof(FRHIDispatchIndirectParameters));
+	}
+
+	{
+		FQuadtreeMeshTraversalDrawArgsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FQuadtreeMeshTraversalDrawArgsCS::FParameters>();
+		PassParameters->Traversal = TraversalParameters;
+		PassParameters->BucketIndexCounts = GraphBuilder.CreateSRV(BucketIndexCounts);
+		PassParameters->BucketCounts = BucketCountsUAV;
+		PassParameters->DrawArgs = GraphBuilder.CreateUAV(IndirectArgs, PF_R32_UINT);
+		FComputeShaderUtils::AddPass(GraphBuilder, RDG_EVENT_NAME("DrawArgs"), TShaderMapRef<FQuadtreeMeshTraversalDrawArgsCS>(ShaderMap), PassParameters,
+			FComputeShaderUtils::GetGroupCount(InParams.NumBuckets, FQuadtreeMeshTraversalShader::ThreadGroupSize));
+	}
+
+	// The mesh draws bind the buffers directly, outside of the graph
+	for (FRDGBufferRef InstanceBuffer : InstanceBuffers)
+	{
+		GraphBuilder.UseExternalAccessMode(InstanceBuffer, ERHIAccess::VertexOrIndexBuffer);
+	}
+	GraphBuilder.UseExternalAccessMode(IndirectArgs, ERHIAccess::IndirectArgs);
+
+	FTraversalResult Result;
+	for (int32 StreamIndex = 0; StreamIndex < FMeshQuadTree::NumStreams; ++StreamIndex)
+	{
+		Result.InstanceBuffers[StreamIndex] = Buffers.InstanceBuffers[StreamIndex]->GetRHI();
+	}
+	Result.IndirectArgsBuffer = Buffers.IndirectArgsBuffer->GetRHI();
+	Result.BucketCapacity = InParams.BucketCapacity;
+	return Result;
+}
+
+void FMeshQuadTreeGPU::Emulate(const FMeshQuadTree& InTree, const FTraverseParams& InParams, FMeshQuadTree::FTraversalOutput& Output)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(EmulateGPUQuadtreeTraversal);
+	check(Output.BucketInstanceCounts.Num() == InParams.NumBuckets && Output.BucketInstanceData.Num() == InParams.NumBuckets);
+
+	if (InTree.NodeData.Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	// Same packed nodes as the kernels, so that the packing is covered as well
+	TArray<FUintVector4> Nodes;
+	BuildNodes(InTree, Nodes);
+
+	FQuadtreeMeshTraversalEmulation Emulation(Nodes, InParams, Output);
+	Emulation.Run();
+}
+
+bool FMeshQuadTreeGPU::ValidateEmulation(const FMeshQuadTree& InTree, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, int32 InBucketCapacity)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(ValidateGPUQuadtreeTraversal);
+
+	FTraverseParams Params;
+	BuildTraverseParams(InTree, InTraversalDesc, InBucketCapacity, Params);
+
+	FMeshQuadTree::FTraversalOutput EmulatedOutput;
+	EmulatedOutput.Reset(Params.NumBuckets);
+	Emulate(InTree, Params, EmulatedOutput);
+
+	FMeshQuadTree::FTraversalOutput ReferenceOutput;
+	ReferenceOutput.Reset(Params.NumBuckets);
+	InTree.BuildQuadtreeMeshTileInstanceData(InTraversalDesc, ReferenceOutput);
+
+	// Instances are identified by their tile, packed in the first stream
+	auto GetSortedInstances = [](const FMeshQuadTree::FBucketInstanceData& InBucket)
+	{
+		TArray<int32> SortedInstances;
+		for (int32 InstanceIndex = 0; InstanceIndex < InBucket.Streams[0].Num(); ++InstanceIndex)
+		{
+			SortedInstances.Add(InstanceIndex);
+		}
+		SortedInstances.Sort([&InBucket](int32 Lhs, int32 Rhs)
+		{
+			const uint32 LhsTile = std::bit_cast<uint32>(InBucket.Streams[0][Lhs].X);
+			const uint32 RhsTile = std::bit_cast<uint32>(InBucket.Streams[0][Rhs].X);
+			if (LhsTile != RhsTile)
+			{
+				return LhsTile < RhsTile;
+			}
+			return (std::bit_cast<uint32>(InBucket.Streams[0][Lhs].Z) & 0x7C00) < (std::bit_cast<uint32>(InBucket.Streams[0][Rhs].Z) & 0x7C00);
+		});
+		return SortedInstances;
+	};
+
+	// Nothing in the instances is rounded from a world position, both traversals have to match bit for bit
+	auto IsSameInstance = [](const FMeshQuadTree::FBucketInstanceData& InLhsBucket, int32 InLhsIndex, const FMeshQuadTree::FBucketInstanceData& InRhsBucket, int32 InRhsIndex)
+	{
+		for (int32 StreamIndex = 0; StreamIndex < FMeshQuadTree::NumStreams; ++StreamIndex)
+		{
+			if (FMemory::Memcmp(&InLhsBucket.Streams[StreamIndex][InLhsIndex], &InRhsBucket.Streams[StreamIndex][InRhsIndex], sizeof(FVector4f)) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	int32 FirstDifferenceBucket = INDEX_NONE;
+	int32 FirstDifference = INDEX_NONE;
+	for (int32 BucketIndex = 0; BucketIndex < Params.NumBuckets && FirstDifference == INDEX_NONE; ++BucketIndex)
+	{
+		const FMeshQuadTree::FBucketInstanceData& EmulatedBucket = EmulatedOutput.BucketInstanceData[BucketIndex];
+		const FMeshQuadTree::FBucketInstanceData& ReferenceBucket = ReferenceOutput.BucketInstanceData[BucketIndex];
+		const TArray<int32> EmulatedInstances = GetSortedInstances(EmulatedBucket);
+		const TArray<int32> ReferenceInstances = GetSortedInstances(ReferenceBucket);
+		const int32 NumInstances = FMath::Min(EmulatedInstances.Num(), ReferenceInstances.Num());
+		for (int32 InstanceIndex = 0; InstanceIndex < NumInstances && FirstDifference == INDEX_NONE; ++InstanceIndex)
+		{
+			if (!IsSameInstance(EmulatedBucket, EmulatedInstances[InstanceIndex], ReferenceBucket, ReferenceInstances[InstanceIndex]))
+			{
+				FirstDifferenceBucket = BucketIndex;
+				FirstDifference = InstanceIndex;
+			}
+		}
+	}
+
+	const bool bIdentical = (FirstDifference == INDEX_NONE)
+		&& (EmulatedOutput.InstanceCount == ReferenceOutput.InstanceCount)
+		&& (EmulatedOutput.BucketInstanceCounts == ReferenceOutput.BucketInstanceCounts);
+	ensureMsgf(bIdentical, TEXT("GPU quadtree traversal doesn't match the CPU traversal: %d instances instead of %d, first difference at sorted instance %d of bucket %d"), EmulatedOutput.InstanceCount, ReferenceOutput.InstanceCount, FirstDifference, FirstDifferenceBucket);
+	return bIdentical;
+}
+
+void FMeshQuadTreeGPU::Release()
+{
+	NodesBuffer.SafeRelease();
+	TraversalBuffers.Empty();
+	NumUsedTraversalBuffers = 0;
+	FrameNumber = INDEX_NONE;
+}
+
+uint32 FMeshQuadTreeGPU::GetAllocatedSize() const
+{
+	return TraversalBuffers.GetAllocatedSize();
+}
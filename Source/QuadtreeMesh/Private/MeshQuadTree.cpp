@@ -1,6 +1,32 @@
 ﻿#include "MeshQuadTree.h"
+#include "Async/ParallelFor.h"
 #include<format>
 
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshNodeLayout(
+	TEXT("r.QuadtreeMesh.NodeLayout"),
+	2,
+	TEXT("Memory order of the quadtree nodes, applied when the tree is rebuilt (0: depth first, 1: breadth first, 2: van Emde Boas)"),
+	ECVF_Default);
+
+int32 FMeshQuadTree::GetScreenSpaceErrorLODBias(float InLODScale, float InLeafSize, int32 InNumQuadsPerTileSide, double InProjectionScale, float InTargetPixels)
+{
+	if (InLODScale <= 0.0f || InProjectionScale <= 0.0 || InNumQuadsPerTileSide <= 0 || InTargetPixels <= 0.0f)
+	{
+		return 0;
+	}
+
+	const double TargetLODScale = InLeafSize * InProjectionScale / (InNumQuadsPerTileSide * InTargetPixels);
+	return FMath::Clamp(FMath::RoundToInt32(FMath::Log2(TargetLODScale / InLODScale)), GetMinLODBias(InLODScale, InLeafSize), MaxTreeDepth);
+}
+
+int32 FMeshQuadTree::GetMinLODBias(float InLODScale, float InLeafSize)
+{
+	if (InLODScale <= 0.0f)
+	{
+		return 0;
+	}
+	return FMath::CeilToInt32(FMath::Log2(0.5 * InLeafSize / InLODScale));
+}
 
 void FMeshQuadTree::GatherHitProxies(TArray<TRefCountPtr<HHitProxy>>& OutHitProxies) const
 {
@@ -31,33 +57,32 @@ void FMeshQuadTree::InitTree(const FBox2D& InBounds, float InTileSize, FIntPoint
 
 	TileRegion = InBounds;
 
+	// The read-only nodes are rebuilt from the build nodes in Unlock()
+	NodeData.Nodes.Empty();
+
 	// Allocate theoretical max, shrink later in Lock()
-	// This is so that the node array doesn't move in memory while inserting
-	if (!bIsGPUQuadTree)
-	{
-		NodeData.Nodes.Empty((float)(FMath::Square(RootDim) * 4) / 3.0f);
-	}
-	else
-	{
-		NodeData.Nodes.Empty(1);
-	}
+	// This is so that the node array doesn't move in memory while inserting. GPU trees are built here as well, only their traversal differs
+	NodeData.BuildNodes.Empty((float)(FMath::Square(RootDim) * 4) / 3.0f);
 	
 	NodeData.QuadtreeMeshRenderData.Empty(1);
 	NodeData.QuadtreeMeshRenderData.AddDefaulted();
 
-	ensure(NodeData.Nodes.Num() == 0);
+	ensure(NodeData.BuildNodes.Num() == 0);
 
 	// Add the root node at slot 0
-	NodeData.Nodes.Emplace();
+	NodeData.BuildNodes.Emplace();
 
 	const float RootWorldSize = RootDim * InTileSize;
 
 	TreeDepth = static_cast<int32>(FMath::Log2(RootDim));
 
+	// Tile coordinates of the compact nodes are 16 bits
+	check(TreeDepth <= MaxTreeDepth);
+
 	// Init root node bounds with invalid Z since that will be updated as nodes are added to the tree
-	NodeData.Nodes[0].Bounds = FBox(FVector(TileRegion.Min, TNumericLimits<float>::Max()), FVector(TileRegion.Min + FVector2D(RootWorldSize, RootWorldSize), TNumericLimits<float>::Lowest()));
+	NodeData.BuildNodes[0].Bounds = FBox(FVector(TileRegion.Min, TNumericLimits<float>::Max()), FVector(TileRegion.Min + FVector2D(RootWorldSize, RootWorldSize), TNumericLimits<float>::Lowest()));
 
-	ensure(NodeData.Nodes.Num() == 1);
+	ensure(NodeData.BuildNodes.Num() == 1);
 
 	bIsReadOnly = false;
 }
@@ -73,17 +98,17 @@ void FMeshQuadTree::Unlock(bool bPruneRedundantNodes)
 			if (NodeIndex != EndIndex)
 			{
 				// Swap to back. All the children of this node would have already been removed (or didn't exist to begin with), so don't care about those
-				NodeData.Nodes.SwapMemory(NodeIndex, EndIndex);
+				NodeData.BuildNodes.SwapMemory(NodeIndex, EndIndex);
 
 				// Patch up the newly moved good node (parent and children)
-				FNode& MovedNode = NodeData.Nodes[NodeIndex];
-				FNode& MovedNodeParent = NodeData.Nodes[MovedNode.ParentIndex];
+				FBuildNode& MovedNode = NodeData.BuildNodes[NodeIndex];
+				FBuildNode& MovedNodeParent = NodeData.BuildNodes[MovedNode.ParentIndex];
 
 				for (int32 i = 0; i < 4; i++)
 				{
 					if (MovedNode.Children[i] > 0)
 					{
-						NodeData.Nodes[MovedNode.Children[i]].ParentIndex = NodeIndex;
+						NodeData.BuildNodes[MovedNode.Children[i]].ParentIndex = NodeIndex;
 					}
 
 					if (MovedNodeParent.Children[i] == EndIndex)
@@ -96,10 +121,10 @@ void FMeshQuadTree::Unlock(bool bPruneRedundantNodes)
 
 		// Remove redundant nodes
 		// Remove from the back, since all removalbe children are further back than their parent in the node list and we want to remove bottom-up
-		int32 EndIndex = NodeData.Nodes.Num() - 1;
+		int32 EndIndex = NodeData.BuildNodes.Num() - 1;
 		for (int NodeIndex = EndIndex; NodeIndex > 0; NodeIndex--)
 		{
-			FNode& ParentNode = NodeData.Nodes[NodeData.Nodes[NodeIndex].ParentIndex];
+			FBuildNode& ParentNode = NodeData.BuildNodes[NodeData.BuildNodes[NodeIndex].ParentIndex];
 			
 			if (ParentNode.HasCompleteSubtree && ParentNode.IsSubtreeSameQuadtreeMesh)
 			{
@@ -111,7 +136,7 @@ void FMeshQuadTree::Unlock(bool bPruneRedundantNodes)
 				// Move back one step down
 				EndIndex--;
 			}
-			else if (!NodeData.Nodes[NodeIndex].HasMaterial && NodeData.Nodes[NodeIndex].HasCompleteSubtree && NodeData.Nodes[NodeIndex].IsSubtreeSameQuadtreeMesh)
+			else if (!NodeData.BuildNodes[NodeIndex].HasMaterial && NodeData.BuildNodes[NodeIndex].HasCompleteSubtree && NodeData.BuildNodes[NodeIndex].IsSubtreeSameQuadtreeMesh)
 			{
 				for (int32 i = 0; i < 4; i++)
 				{
@@ -128,17 +153,229 @@ void FMeshQuadTree::Unlock(bool bPruneRedundantNodes)
 			}
 		}
 
-		NodeData.Nodes.SetNum(EndIndex + 1);
+		NodeData.BuildNodes.SetNum(EndIndex + 1);
 	}
 
+	BuildCompactNodes();
+	RelayoutNodes(static_cast<ENodeLayout>(FMath::Clamp(CVarQuadtreeMeshNodeLayout.GetValueOnAnyThread(), 0, 2)));
+
 	bIsReadOnly = true;
 }
 
+void FMeshQuadTree::BuildCompactNodes()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BuildCompactNodes);
+
+	NodeData.Nodes.Empty(NodeData.BuildNodes.Num());
+
+	if (NodeData.BuildNodes.Num() > 0)
+	{
+		// The root Z range contains all the tiles. It's still invalid if no tiles were added
+		const FBox& RootBounds = NodeData.BuildNodes[0].Bounds;
+		if (RootBounds.Min.Z <= RootBounds.Max.Z)
+		{
+			MinZ = RootBounds.Min.Z;
+			MaxZ = RootBounds.Max.Z;
+		}
+		else
+		{
+			MinZ = 0.0;
+			MaxZ = 0.0;
+		}
+
+		// Nodes are reserved upfront, so node references stay valid while the subtrees are added
+		NodeData.Nodes.AddDefaulted();
+		BuildCompactNode(0, 0, 0, 0, TreeDepth);
+
+		// Every build node is reachable from the root, pruning relinks or removes the others
+		check(NodeData.Nodes.Num() == NodeData.BuildNodes.Num());
+	}
+
+	NodeData.BuildNodes.Empty();
+}
+
+void FMeshQuadTree::BuildCompactNode(uint32 InBuildNodeIndex, uint32 InNodeIndex, uint32 InTileX, uint32 InTileY, uint32 InLevel)
+{
+	const FBuildNode& BuildNode = NodeData.BuildNodes[InBuildNodeIndex];
+	FNode& Node = NodeData.Nodes[InNodeIndex];
+
+	Node.TileX = static_cast<uint16>(InTileX);
+	Node.TileY = static_cast<uint16>(InTileY);
+	Node.Level = InLevel;
+	Node.QuadtreeMeshIndex = static_cast<uint16>(BuildNode.QuadtreeMeshIndex);
+	Node.TransitionQuadtreeMeshIndex = static_cast<uint16>(BuildNode.TransitionQuadtreeMeshIndex);
+	Node.HasCompleteSubtree = BuildNode.HasCompleteSubtree;
+	Node.IsSubtreeSameQuadtreeMesh = BuildNode.IsSubtreeSameQuadtreeMesh;
+	Node.HasMaterial = BuildNode.HasMaterial;
+
+	// Round outwards so that the quantized range always contains the node
+	const double ZScale = (MaxZ > MinZ) ? ZQuantizationMax / (MaxZ - MinZ) : 0.0;
+	Node.QuantizedMinZ = FMath::Clamp(FMath::FloorToInt32((BuildNode.Bounds.Min.Z - MinZ) * ZScale), 0, static_cast<int32>(ZQuantizationMax));
+	Node.QuantizedMaxZ = FMath::Clamp(FMath::CeilToInt32((BuildNode.Bounds.Max.Z - MinZ) * ZScale), 0, static_cast<int32>(ZQuantizationMax));
+
+	uint32 ChildMask = 0;
+	for (int32 i = 0; i < 4; i++)
+	{
+		if (BuildNode.Children[i] > 0)
+		{
+			ChildMask |= 1u << i;
+		}
+	}
+	Node.ChildMask = ChildMask;
+
+	if (ChildMask == 0)
+	{
+		return;
+	}
+
+	// Allocate all the children first so they are contiguous, then fill in their subtrees
+	const uint32 FirstChild = NodeData.Nodes.Num();
+	Node.FirstChild = FirstChild;
+	NodeData.Nodes.AddDefaulted(FMath::CountBits(ChildMask));
+
+	const uint32 ChildSize = 1u << (InLevel - 1);
+	uint32 ChildNodeIndex = FirstChild;
+	for (int32 i = 0; i < 4; i++)
+	{
+		if (BuildNode.Children[i] > 0)
+		{
+			BuildCompactNode(BuildNode.Children[i], ChildNodeIndex++, InTileX + (i & 1) * ChildSize, InTileY + (i >> 1) * ChildSize, InLevel - 1);
+		}
+	}
+}
+
+void FMeshQuadTree::RelayoutNodes(ENodeLayout InLayout)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(RelayoutNodes);
+
+	const TArray<FNode>& OldNodes = NodeData.Nodes;
+	if (InLayout == ENodeLayout::DepthFirst || OldNodes.Num() == 0)
+	{
+		return;
+	}
+
+	// The new order as old node indices. The children of a node are always added together so they stay contiguous
+	TArray<uint32> NewToOld;
+	NewToOld.Reserve(OldNodes.Num());
+	NewToOld.Add(0);
+
+	if (InLayout == ENodeLayout::BreadthFirst)
+	{
+		for (int32 NewIndex = 0; NewIndex < NewToOld.Num(); ++NewIndex)
+		{
+			const FNode& Node = OldNodes[NewToOld[NewIndex]];
+			for (uint32 ChildIndex = Node.FirstChild; ChildIndex < Node.FirstChild + Node.GetChildCount(); ++ChildIndex)
+			{
+				NewToOld.Add(ChildIndex);
+			}
+		}
+	}
+	else
+	{
+		struct FVanEmdeBoasLayout
+		{
+			const TArray<FNode>& Nodes;
+			TArray<uint32>& NewToOld;
+
+			/** Add the descendants of a node down to InHeight levels below it. The node itself was already added with its siblings */
+			void AddSubtree(uint32 InNodeIndex, uint32 InHeight)
+			{
+				const FNode& Node = Nodes[InNodeIndex];
+				if (InHeight == 0 || Node.ChildMask == 0)
+				{
+					return;
+				}
+
+				if (InHeight == 1)
+				{
+					for (uint32 ChildIndex = Node.FirstChild; ChildIndex < Node.FirstChild + Node.GetChildCount(); ++ChildIndex)
+					{
+						NewToOld.Add(ChildIndex);
+					}
+					return;
+				}
+
+				// Top half first, then each of the bottom subtrees hanging below it
+				const uint32 TopHeight = InHeight / 2;
+				AddSubtree(InNodeIndex, TopHeight);
+
+				TArray<uint32, TInlineAllocator<64>> BottomRoots;
+				GatherDescendants(InNodeIndex, TopHeight, BottomRoots);
+				for (const uint32 BottomRoot : BottomRoots)
+				{
+					AddSubtree(BottomRoot, InHeight - TopHeight);
+				}
+			}
+
+			void GatherDescendants(uint32 InNodeIndex, uint32 InDepth, TArray<uint32, TInlineAllocator<64>>& OutNodeIndices) const
+			{
+				if (InDepth == 0)
+				{
+					OutNodeIndices.Add(InNodeIndex);
+					return;
+				}
+
+				const FNode& Node = Nodes[InNodeIndex];
+				for (uint32 ChildIndex = Node.FirstChild; ChildIndex < Node.FirstChild + Node.GetChildCount(); ++ChildIndex)
+				{
+					GatherDescendants(ChildIndex, InDepth - 1, OutNodeIndices);
+				}
+			}
+		};
+
+		FVanEmdeBoasLayout{ OldNodes, NewToOld }.AddSubtree(0, OldNodes[0].Level);
+	}
+
+	check(NewToOld.Num() == OldNodes.Num());
+
+	TArray<uint32> OldToNew;
+	OldToNew.SetNumUninitialized(OldNodes.Num());
+	for (int32 NewIndex = 0; NewIndex < NewToOld.Num(); ++NewIndex)
+	{
+		OldToNew[NewToOld[NewIndex]] = NewIndex;
+	}
+
+	TArray<FNode> NewNodes;
+	NewNodes.Reserve(OldNodes.Num());
+	for (const uint32 OldIndex : NewToOld)
+	{
+		FNode& Node = NewNodes.Add_GetRef(OldNodes[OldIndex]);
+		if (Node.ChildMask != 0)
+		{
+			Node.FirstChild = OldToNew[Node.FirstChild];
+		}
+	}
+
+	NodeData.Nodes = MoveTemp(NewNodes);
+}
+
+FBox FMeshQuadTree::GetBounds() const
+{
+	if (NodeData.Nodes.Num() > 0)
+	{
+		return GetNodeBounds(NodeData.Nodes[0]);
+	}
+
+	if (NodeData.BuildNodes.Num() > 0)
+	{
+		return NodeData.BuildNodes[0].Bounds;
+	}
+
+	return FBox(-FVector::OneVector, FVector::OneVector);
+}
+
+FBox FMeshQuadTree::GetNodeBounds(const FNode& InNode) const
+{
+	const double ZStep = (MaxZ - MinZ) / ZQuantizationMax;
+	const FVector2D Min = TileRegion.Min + FVector2D(InNode.TileX, InNode.TileY) * static_cast<double>(LeafSize);
+	const FVector2D Max = Min + FVector2D(static_cast<double>(InNode.GetSizeInTiles()) * LeafSize);
+	return FBox(FVector(Min, MinZ + InNode.QuantizedMinZ * ZStep), FVector(Max, MinZ + InNode.QuantizedMaxZ * ZStep));
+}
+
 void FMeshQuadTree::AddQuadtreeMeshTilesInsideBounds(const FBox& InBounds, uint32 InQuadtreeMeshIndex)
 {
 	check(!bIsReadOnly);
-	check(!bIsGPUQuadTree);
-	NodeData.Nodes[0].AddNodes(NodeData, FBox(FVector(TileRegion.Min, 0.0f), FVector(TileRegion.Max, 0.0f)),  InBounds, InQuadtreeMeshIndex, TreeDepth, 0);
+	NodeData.BuildNodes[0].AddNodes(NodeData, FBox(FVector(TileRegion.Min, 0.0f), FVector(TileRegion.Max, 0.0f)),  InBounds, InQuadtreeMeshIndex, TreeDepth, 0);
 }
 
 void FMeshQuadTree::AddQuadtreeMesh(const TArray<FVector2D>& InPoly, const FBox& InMeshBounds, uint32 InQuadtreeMeshIndex)
@@ -192,15 +429,205 @@ void FMeshQuadTree::BuildMaterialIndices()
 	}
 }
 
+void FMeshQuadTree::FTraversalOutput::Reset(int32 InNumBuckets)
+{
+	BucketInstanceCounts.Reset();
+	BucketInstanceCounts.AddZeroed(InNumBuckets);
+	BucketInstanceData.SetNum(InNumBuckets);
+	for (FBucketInstanceData& Bucket : BucketInstanceData)
+	{
+		for (TArray<FVector4f>& Stream : Bucket.Streams)
+		{
+			Stream.Reset();
+		}
+	}
+	InstanceCount = 0;
+}
+
 void FMeshQuadTree::BuildQuadtreeMeshTileInstanceData(const FTraversalDesc& InTraversalDesc,
 	FTraversalOutput& Output) const
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(BuildQuadtreeMeshTileInstanceData);
 	check(bIsReadOnly);
+	check(Output.BucketInstanceData.Num() == Output.BucketInstanceCounts.Num());
 	
-	if (!bIsGPUQuadTree)
+	// GPU trees are still traversed here for the views the GPU traversal doesn't support, for ray tracing and for validation
+	if (NodeData.Nodes.Num() > 0)
 	{
-		NodeData.Nodes[0].SelectLOD(NodeData, TreeDepth, InTraversalDesc, Output);
+		const FTraversalContext Context(*this, InTraversalDesc);
+
+		bool bHasHitProxies = false;
+#if WITH_EDITOR
+		for (const FQuadtreeMeshRenderData& QuadtreeMeshRenderData : NodeData.QuadtreeMeshRenderData)
+		{
+			bHasHitProxies |= QuadtreeMeshRenderData.HitProxy.IsValid();
+		}
+#endif
+
+		bool bDebug = false;
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+		bDebug = (InTraversalDesc.DebugShowTile != 0) && (InTraversalDesc.DebugPDI != nullptr);
+#endif
+
+		// Dispatch once to the traversal compiled for these options, see TTraversalPolicyFromIndex
+		using FBuildFunction = void (FMeshQuadTree::*)(const FTraversalContext&, FTraversalOutput&) const;
+		static constexpr FBuildFunction BuildFunctions[] =
+		{
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<0>>,  &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<1>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<2>>,  &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<3>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<4>>,  &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<5>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<6>>,  &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<7>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<8>>,  &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<9>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<10>>, &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<11>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<12>>, &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<13>>,
+			&FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<14>>, &FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy<TTraversalPolicyFromIndex<15>>,
+		};
+		const uint32 PolicyIndex = ((Context.AllPlanesMask != 0 || Context.HorizonBins.Num() > 0) ? 1 : 0)
+			| (InTraversalDesc.bLODMorphingEnabled ? 2 : 0)
+			| (bHasHitProxies ? 4 : 0)
+			| (bDebug ? 8 : 0);
+		(this->*BuildFunctions[PolicyIndex])(Context, Output);
+
+		if (InTraversalDesc.bSortFrontToBack)
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE(SortFrontToBack);
+
+			// Distance on XY from the observer to the closest point of each tile, in tile space like the instances
+			const FVector2f TileObserverPosition = FVector2f((FVector2D(InTraversalDesc.ObserverPosition) - TileRegion.Min) / LeafSize);
+			TArray<float> SquaredDistances;
+			TArray<int32> SortedInstances;
+			TArray<FVector4f> SortedStream;
+			for (FBucketInstanceData& Bucket : Output.BucketInstanceData)
+			{
+				const int32 NumInstances = Bucket.Streams[0].Num();
+				SquaredDistances.SetNumUninitialized(NumInstances);
+				SortedInstances.SetNumUninitialized(NumInstances);
+				for (int32 InstanceIndex = 0; InstanceIndex < NumInstances; ++InstanceIndex)
+				{
+					SquaredDistances[InstanceIndex] = GetInstanceTileBounds(Bucket.Streams[0][InstanceIndex]).ComputeSquaredDistanceToPoint(TileObserverPosition);
+					SortedInstances[InstanceIndex] = InstanceIndex;
+				}
+				SortedInstances.StableSort([&SquaredDistances](int32 Lhs, int32 Rhs)
+				{
+					return SquaredDistances[Lhs] < SquaredDistances[Rhs];
+				});
+
+				// Only the order within a bucket matters, each bucket is drawn on its own
+				for (TArray<FVector4f>& Stream : Bucket.Streams)
+				{
+					SortedStream.SetNumUninitialized(NumInstances);
+					for (int32 InstanceIndex = 0; InstanceIndex < NumInstances; ++InstanceIndex)
+					{
+						SortedStream[InstanceIndex] = Stream[SortedInstances[InstanceIndex]];
+					}
+					Swap(Stream, SortedStream);
+				}
+			}
+		}
+	}
+}
+
+template<typename TPolicy>
+void FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataWithPolicy(const FTraversalContext& InContext, FTraversalOutput& Output) const
+{
+	const FTraversalDesc& InTraversalDesc = InContext.TraversalDesc;
+
+	FTraversalItem RootItem;
+	if (!InContext.MakeRootItem<TPolicy>(RootItem))
+	{
+		return;
+	}
+
+	if (InTraversalDesc.InstanceBudget > 0 || InTraversalDesc.VertexBudget > 0)
+	{
+		InContext.TraverseWithBudget<TPolicy>(RootItem, Output);
+		return;
+	}
+
+	// Debug drawing is not thread safe
+	const bool bParallelTraversal = (InTraversalDesc.ParallelSplitDepth > 0) && !TPolicy::bDebug;
+
+	if (bParallelTraversal)
+	{
+		BuildQuadtreeMeshTileInstanceDataParallel<TPolicy>(InContext, RootItem, Output);
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+		if (InTraversalDesc.bValidateParallelTraversal)
+		{
+			FTraversalOutput ReferenceOutput;
+			ReferenceOutput.Reset(Output.BucketInstanceCounts.Num());
+			InContext.Traverse<TPolicy>(RootItem, ReferenceOutput);
+
+			bool bIdentical = (ReferenceOutput.InstanceCount == Output.InstanceCount)
+				&& (ReferenceOutput.BucketInstanceCounts == Output.BucketInstanceCounts);
+			for (int32 BucketIndex = 0; bIdentical && BucketIndex < Output.BucketInstanceData.Num(); ++BucketIndex)
+			{
+				for (int32 StreamIndex = 0; StreamIndex < NumStreams; ++StreamIndex)
+				{
+					const TArray<FVector4f>& ReferenceStream = ReferenceOutput.BucketInstanceData[BucketIndex].Streams[StreamIndex];
+					const TArray<FVector4f>& Stream = Output.BucketInstanceData[BucketIndex].Streams[StreamIndex];
+					bIdentical &= (ReferenceStream.Num() == Stream.Num())
+						&& (FMemory::Memcmp(ReferenceStream.GetData(), Stream.GetData(), Stream.Num() * sizeof(FVector4f)) == 0);
+				}
+			}
+			ensureMsgf(bIdentical, TEXT("Parallel quadtree traversal (split depth %d) doesn't match the serial traversal: %d instances instead of %d"), InTraversalDesc.ParallelSplitDepth, Output.InstanceCount, ReferenceOutput.InstanceCount);
+		}
+#endif
+	}
+	else
+	{
+		InContext.Traverse<TPolicy>(RootItem, Output);
+	}
+}
+
+template<typename TPolicy>
+void FMeshQuadTree::BuildQuadtreeMeshTileInstanceDataParallel(const FTraversalContext& InContext, const FTraversalItem& InRootItem, FTraversalOutput& Output) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BuildQuadtreeMeshTileInstanceDataParallel);
+
+	TArray<FTraversalItem> Tasks;
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(GatherTraversalTasks);
+		InContext.GatherTraversalTasks<TPolicy>(InRootItem, InContext.TraversalDesc.ParallelSplitDepth, Tasks);
+	}
+
+	TArray<FTraversalOutput> TaskOutputs;
+	TaskOutputs.SetNum(Tasks.Num());
+
+	ParallelFor(TEXT("QuadtreeMesh.SubtreeTraversal"), Tasks.Num(), 1, [&Tasks, &TaskOutputs, &InContext, &Output](int32 TaskIndex)
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(SubtreeTraversal);
+
+		FTraversalOutput& TaskOutput = TaskOutputs[TaskIndex];
+		TaskOutput.Reset(Output.BucketInstanceCounts.Num());
+		InContext.Traverse<TPolicy>(Tasks[TaskIndex], TaskOutput);
+	});
+
+	// Merge in task order. Tasks were gathered in the order the serial traversal visits them, so the merged output is identical to the serial one
+	for (int32 BucketIndex = 0; BucketIndex < Output.BucketInstanceCounts.Num(); ++BucketIndex)
+	{
+		int32 BucketInstanceCount = Output.BucketInstanceCounts[BucketIndex];
+		for (const FTraversalOutput& TaskOutput : TaskOutputs)
+		{
+			BucketInstanceCount += TaskOutput.BucketInstanceCounts[BucketIndex];
+		}
+		for (TArray<FVector4f>& Stream : Output.BucketInstanceData[BucketIndex].Streams)
+		{
+			Stream.Reserve(BucketInstanceCount);
+		}
+	}
+
+	for (const FTraversalOutput& TaskOutput : TaskOutputs)
+	{
+		for (int32 BucketIndex = 0; BucketIndex < Output.BucketInstanceCounts.Num(); ++BucketIndex)
+		{
+			Output.BucketInstanceCounts[BucketIndex] += TaskOutput.BucketInstanceCounts[BucketIndex];
+			for (int32 StreamIndex = 0; StreamIndex < NumStreams; ++StreamIndex)
+			{
+				Output.BucketInstanceData[BucketIndex].Streams[StreamIndex].Append(TaskOutput.BucketInstanceData[BucketIndex].Streams[StreamIndex]);
+			}
+		}
+		Output.InstanceCount += TaskOutput.InstanceCount;
 	}
 }
 
@@ -247,7 +674,26 @@ bool FMeshQuadTree::QueryTileBaseHeightAtLocation(const FVector2D& InWorldLocati
 	if (GetNodeCount() > 0)
 	{
 		check(bIsReadOnly);
-		return NodeData.Nodes[0].QueryBaseHeightAtLocation(NodeData, InWorldLocationXY, OutWorldHeight);
+		const FVector2D TileLocationXY = (InWorldLocationXY - TileRegion.Min) / static_cast<double>(LeafSize);
+
+		// Note: Since we prune the quadtree of anything below this condition, it means there are no more granular nodes to fetch below this. In theory we could skip the pruning and have slightly more accurate height sampling, since rivers might have leaf nodes with individual bounds.
+		// Same condition as leaf nodes
+		const FNode* Node = &NodeData.Nodes[0];
+		while (!Node->HasImplicitChildren())
+		{
+			const FNode* ChildNode = Node->FindChildAtLocation(NodeData, TileLocationXY);
+			if (!ChildNode)
+			{
+				// Return regular base height when there's not valid sample. Point is not in any of the children, return false
+				OutWorldHeight = NodeData.QuadtreeMeshRenderData[Node->QuadtreeMeshIndex].SurfaceBaseHeight;
+				return false;
+			}
+			Node = ChildNode;
+		}
+
+		// Return "accurate" base height when there's a valid sample
+		OutWorldHeight = NodeData.QuadtreeMeshRenderData[Node->QuadtreeMeshIndex].SurfaceBaseHeight;
+		return true;
 	}
 	
 	OutWorldHeight = 0.0f;
@@ -260,7 +706,16 @@ bool FMeshQuadTree::QueryTileBoundsAtLocation(const FVector2D& InWorldLocationXY
 	if (GetNodeCount() > 0)
 	{
 		check(bIsReadOnly);
-		return NodeData.Nodes[0].QueryBoundsAtLocation(NodeData, InWorldLocationXY, OutWorldBounds);
+		const FVector2D TileLocationXY = (InWorldLocationXY - TileRegion.Min) / static_cast<double>(LeafSize);
+		const FNode* Node = &NodeData.Nodes[0];
+		while (const FNode* ChildNode = Node->FindChildAtLocation(NodeData, TileLocationXY))
+		{
+			Node = ChildNode;
+		}
+		OutWorldBounds = GetNodeBounds(*Node);
+
+		// No children, this is a leaf node, return true. Otherwise reaching here means none of the children contain the sampling location, so return false
+		return Node->ChildMask == 0;
 	}
 
 	OutWorldBounds = FBox(ForceInit);
@@ -268,274 +723,922 @@ bool FMeshQuadTree::QueryTileBoundsAtLocation(const FVector2D& InWorldLocationXY
 }
 
 
-bool FMeshQuadTree::FNode::CanRender(int32 InDensityLevel, int32 InForceCollapseDensityLevel,
-                                     const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData) const
+FMeshQuadTree::FTraversalContext::FTraversalContext(const FMeshQuadTree& InTree, const FTraversalDesc& InTraversalDesc)
+	: NodeData(InTree.NodeData)
+	, TraversalDesc(InTraversalDesc)
+	, TreeDepth(InTree.TreeDepth)
+	, LeafSize(InTree.LeafSize)
+	, MinZ(InTree.MinZ)
 {
-	return InQuadtreeMeshRenderData.Material && IsSubtreeSameQuadtreeMesh && ((InDensityLevel > InForceCollapseDensityLevel) || HasCompleteSubtree);
+	Origin = InTree.GetOrigin();
+	ZStep = static_cast<float>((InTree.MaxZ - InTree.MinZ) / ZQuantizationMax);
+
+	// World = Origin + (LeafSize * Tile.XY, Tile.Z). Substituting that in the plane equations gives the tile space planes
+	// Done in double so that large world coordinates don't lose precision before the result is small enough for floats
+	// Planes are tracked in a 32 bit mask during traversal
+	check(InTraversalDesc.Frustum.Planes.Num() <= 32);
+	PlaneVectors.Reserve(InTraversalDesc.Frustum.Planes.Num());
+	for (const FPlane& Plane : InTraversalDesc.Frustum.Planes)
+	{
+		const float PlaneX = static_cast<float>(Plane.X * LeafSize);
+		const float PlaneY = static_cast<float>(Plane.Y * LeafSize);
+		const float PlaneZ = static_cast<float>(Plane.Z);
+		const float PlaneW = static_cast<float>(-Plane.PlaneDot(Origin));
+		PlaneVectors.Add({ VectorSetFloat1(PlaneX), VectorSetFloat1(PlaneY), VectorSetFloat1(PlaneZ), VectorSetFloat1(PlaneW),
+			VectorSetFloat1(FMath::Abs(PlaneX) + FMath::Abs(PlaneY)), VectorSetFloat1(FMath::Abs(PlaneZ)) });
+	}
+	FrustumPlanesMask = (PlaneVectors.Num() < 32) ? (1u << PlaneVectors.Num()) - 1 : ~0u;
+
+	if ((InTraversalDesc.bFootprintCulling && InTraversalDesc.Frustum.Planes.Num() > 0) || InTraversalDesc.UnionFrusta.Num() > 0)
+	{
+		BuildFootprintPlanes(InTree.MaxZ - InTree.MinZ, static_cast<double>(1 << InTree.TreeDepth));
+	}
+	AllPlanesMask = FrustumPlanesMask | FootprintPlanesMask;
+
+	ObserverPosition = FVector2f((FVector2D(InTraversalDesc.ObserverPosition) - InTree.TileRegion.Min) / LeafSize);
+
+	// With a focus region, the tiles touching it are at LOD 0 and the LODs get coarser away from it, wherever the observer is
+	LODRegion = FBox2f(ObserverPosition, ObserverPosition);
+	if (InTraversalDesc.TessellatedQuadtreeMeshBounds.bIsValid)
+	{
+		LODRegion = FBox2f(
+			FVector2f((InTraversalDesc.TessellatedQuadtreeMeshBounds.Min - InTree.TileRegion.Min) / LeafSize),
+			FVector2f((InTraversalDesc.TessellatedQuadtreeMeshBounds.Max - InTree.TileRegion.Min) / LeafSize));
+	}
+	LODRegionMinX = VectorSetFloat1(LODRegion.Min.X);
+	LODRegionMinY = VectorSetFloat1(LODRegion.Min.Y);
+	LODRegionMaxX = VectorSetFloat1(LODRegion.Max.X);
+	LODRegionMaxY = VectorSetFloat1(LODRegion.Max.Y);
+
+	SquaredLODDistances.SetNumUninitialized(InTree.TreeDepth + 1);
+	for (int32 LODLevel = 0; LODLevel <= InTree.TreeDepth; ++LODLevel)
+	{
+		SquaredLODDistances[LODLevel] = static_cast<float>(FMath::Square(GetLODDistance(LODLevel + InTraversalDesc.LODBias, InTraversalDesc.LODScale) / LeafSize));
+	}
+
+	if (InTraversalDesc.HorizonOccluders.Num() > 0)
+	{
+		BuildHorizon();
+	}
 }
 
-void FMeshQuadTree::FNode::SelectLODRefinement(const FNodeData& InNodeData, int32 InDensityLevel, int32 InLODLevel,
-	const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const
+template<typename TPolicy>
+uint32 FMeshQuadTree::FTraversalContext::CullItems4(FTraversalItem* InOutItems, int32 InItemCount, uint32 InPlaneMask, bool bInComputeDistances) const
 {
-	const FQuadtreeMeshRenderData& QuadtreeMeshRenderData = InNodeData.QuadtreeMeshRenderData[QuadtreeMeshIndex];
-	const FVector CenterPosition = Bounds.GetCenter();
-	const FVector Extent = Bounds.GetExtent();
+	check(InItemCount <= 4);
+	if (InItemCount <= 0)
+	{
+		return 0;
+	}
+
+	const uint32 AllNodesMask = (1u << InItemCount) - 1;
 
-	// Early out on frustum culling 
-	if (InTraversalDesc.Frustum.IntersectBox(CenterPosition, Extent))
+	// Flat nodes are tested against the footprint of the frustum, nodes with a large Z range against the frustum itself
+	uint32 TestedPlaneMask = 0;
+	if constexpr (TPolicy::bCull)
+	{
+		TestedPlaneMask = InPlaneMask & FrustumPlanesMask;
+	}
+	if (TPolicy::bCull && FootprintPlanesMask != 0)
 	{
-		// This LOD can represent all its leaf nodes, simply add node
-		if (CanRender(InDensityLevel, InTraversalDesc.ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+		uint32 MaxQuantizedZRange = 0;
+		for (int32 i = 0; i < InItemCount; i++)
 		{
-			AddNodeForRender(InNodeData, QuadtreeMeshRenderData, InDensityLevel, InLODLevel, InTraversalDesc, Output);
+			const FNode& Node = NodeData.Nodes[InOutItems[i].NodeIndex];
+			MaxQuantizedZRange = FMath::Max(MaxQuantizedZRange, static_cast<uint32>(Node.QuantizedMaxZ - Node.QuantizedMinZ));
 		}
-		else
+		if (MaxQuantizedZRange * ZStep <= TraversalDesc.FootprintMaxZRange)
+		{
+			TestedPlaneMask = InPlaneMask & FootprintPlanesMask;
+		}
+	}
+
+	// The parent is fully inside the tested planes, so are the nodes
+	if (TestedPlaneMask == 0 && !bInComputeDistances)
+	{
+		for (int32 i = 0; i < InItemCount; i++)
+		{
+			InOutItems[i].PlaneMask = InPlaneMask;
+			InOutItems[i].SquaredDistance = 0.0f;
+		}
+		return (TPolicy::bCull && HorizonBins.Num() > 0) ? CullItemsBehindHorizon(InOutItems, AllNodesMask) : AllNodesMask;
+	}
+
+	// One lane per node. Unused lanes repeat the first node and are masked out at the end
+	alignas(16) float NodeMinX[4];
+	alignas(16) float NodeMinY[4];
+	alignas(16) float NodeSize[4];
+	alignas(16) float NodeMinZ[4];
+	alignas(16) float NodeMaxZ[4];
+	for (int32 i = 0; i < 4; i++)
+	{
+		// Implicit children share the Z range of the stored node they come from
+		const FTraversalItem& Item = InOutItems[i < InItemCount ? i : 0];
+		const FNode& Node = NodeData.Nodes[Item.NodeIndex];
+		NodeMinX[i] = static_cast<float>(Item.TileX);
+		NodeMinY[i] = static_cast<float>(Item.TileY);
+		NodeSize[i] = static_cast<float>(1u << Item.Level);
+		NodeMinZ[i] = static_cast<float>(Node.QuantizedMinZ);
+		NodeMaxZ[i] = static_cast<float>(Node.QuantizedMaxZ);
+	}
+
+	const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+	const VectorRegister4Float MinX = VectorLoadAligned(NodeMinX);
+	const VectorRegister4Float MinY = VectorLoadAligned(NodeMinY);
+	const VectorRegister4Float Size = VectorLoadAligned(NodeSize);
+	const VectorRegister4Float ZStepVector = VectorSetFloat1(ZStep);
+	const VectorRegister4Float BoxMinZ = VectorMultiply(VectorLoadAligned(NodeMinZ), ZStepVector);
+	const VectorRegister4Float BoxMaxZ = VectorMultiply(VectorLoadAligned(NodeMaxZ), ZStepVector);
+
+	// Nodes are square, so the X and Y extents are the same
+	const VectorRegister4Float ExtentXY = VectorMultiply(Size, Half);
+	const VectorRegister4Float ExtentZ = VectorMultiply(VectorSubtract(BoxMaxZ, BoxMinZ), Half);
+	const VectorRegister4Float CenterX = VectorAdd(MinX, ExtentXY);
+	const VectorRegister4Float CenterY = VectorAdd(MinY, ExtentXY);
+	const VectorRegister4Float CenterZ = VectorMultiply(VectorAdd(BoxMinZ, BoxMaxZ), Half);
+
+	for (int32 i = 0; i < InItemCount; i++)
+	{
+		InOutItems[i].PlaneMask = InPlaneMask;
+	}
+
+	// Same test as FConvexVolume::IntersectBox, planes point outwards. Only the planes the parent isn't fully inside of are tested
+	// A node fully inside a plane passes it on to all its descendants by clearing the plane bit of its mask
+	VectorRegister4Float Outside = VectorZeroFloat();
+	for (uint32 PlaneMask = TestedPlaneMask; PlaneMask != 0; PlaneMask &= PlaneMask - 1)
+	{
+		const uint32 PlaneIndex = FMath::CountTrailingZeros(PlaneMask);
+		const FPlaneVectors& Plane = PlaneVectors[PlaneIndex];
+		const VectorRegister4Float Distance = VectorSubtract(VectorMultiplyAdd(CenterZ, Plane.Z, VectorMultiplyAdd(CenterY, Plane.Y, VectorMultiply(CenterX, Plane.X))), Plane.W);
+		const VectorRegister4Float PushOut = VectorMultiplyAdd(ExtentZ, Plane.AbsZ, VectorMultiply(ExtentXY, Plane.AbsXPlusAbsY));
+		Outside = VectorBitwiseOr(Outside, VectorCompareGT(Distance, PushOut));
+
+		for (uint32 InsideMask = VectorMaskBits(VectorCompareGT(VectorNegate(PushOut), Distance)) & AllNodesMask; InsideMask != 0; InsideMask &= InsideMask - 1)
 		{
-			// If not, we need to recurse down the children until we find one that can be rendered
-			for (int32 ChildIndex : Children)
+			InOutItems[FMath::CountTrailingZeros(InsideMask)].PlaneMask &= ~(1u << PlaneIndex);
+		}
+	}
+
+	if (bInComputeDistances)
+	{
+		// Distance on XY between the LOD region and each node, 0 where they overlap
+		const VectorRegister4Float Zero = VectorZeroFloat();
+		const VectorRegister4Float DistanceX = VectorMax(VectorMax(VectorSubtract(MinX, LODRegionMaxX), VectorSubtract(LODRegionMinX, VectorAdd(MinX, Size))), Zero);
+		const VectorRegister4Float DistanceY = VectorMax(VectorMax(VectorSubtract(MinY, LODRegionMaxY), VectorSubtract(LODRegionMinY, VectorAdd(MinY, Size))), Zero);
+
+		alignas(16) float SquaredDistances[4];
+		VectorStoreAligned(VectorMultiplyAdd(DistanceX, DistanceX, VectorMultiply(DistanceY, DistanceY)), SquaredDistances);
+		for (int32 i = 0; i < InItemCount; i++)
+		{
+			InOutItems[i].SquaredDistance = SquaredDistances[i];
+		}
+	}
+
+	const uint32 VisibleMask = ~static_cast<uint32>(VectorMaskBits(Outside)) & AllNodesMask;
+	return (TPolicy::bCull && HorizonBins.Num() > 0) ? CullItemsBehindHorizon(InOutItems, VisibleMask) : VisibleMask;
+}
+
+/** Azimuth range under which a rectangle is seen from InObserver. False if the observer is inside or on the rectangle */
+static bool GetAzimuthRange(const FVector2f& InMin, const FVector2f& InMax, const FVector2f& InObserver, float& OutMinAzimuth, float& OutMaxAzimuth)
+{
+	if (InObserver.X >= InMin.X && InObserver.X <= InMax.X && InObserver.Y >= InMin.Y && InObserver.Y <= InMax.Y)
+	{
+		return false;
+	}
+
+	// Corners relative to the direction of the center, so that the range doesn't wrap around
+	const FVector2f CenterDirection = (InMin + InMax) * 0.5f - InObserver;
+	const float CenterAzimuth = FMath::Atan2(CenterDirection.Y, CenterDirection.X);
+	float MinDelta = 0.0f;
+	float MaxDelta = 0.0f;
+	for (int32 Corner = 0; Corner < 4; Corner++)
+	{
+		const FVector2f CornerDirection = FVector2f((Corner & 1) ? InMax.X : InMin.X, (Corner & 2) ? InMax.Y : InMin.Y) - InObserver;
+		const float Delta = FMath::UnwindRadians(FMath::Atan2(CornerDirection.Y, CornerDirection.X) - CenterAzimuth);
+		MinDelta = FMath::Min(MinDelta, Delta);
+		MaxDelta = FMath::Max(MaxDelta, Delta);
+	}
+
+	OutMinAzimuth = CenterAzimuth + MinDelta;
+	OutMaxAzimuth = CenterAzimuth + MaxDelta;
+	return (MaxDelta - MinDelta) < UE_PI;
+}
+
+/** Nearest and farthest distances from InObserver to a rectangle */
+static void GetDistanceRange(const FVector2f& InMin, const FVector2f& InMax, const FVector2f& InObserver, float& OutNearestDistance, float& OutFarthestDistance)
+{
+	const float NearestX = FMath::Max3(InMin.X - InObserver.X, InObserver.X - InMax.X, 0.0f);
+	const float NearestY = FMath::Max3(InMin.Y - InObserver.Y, InObserver.Y - InMax.Y, 0.0f);
+	const float FarthestX = FMath::Max(FMath::Abs(InMin.X - InObserver.X), FMath::Abs(InMax.X - InObserver.X));
+	const float FarthestY = FMath::Max(FMath::Abs(InMin.Y - InObserver.Y), FMath::Abs(InMax.Y - InObserver.Y));
+	OutNearestDistance = FMath::Sqrt(NearestX * NearestX + NearestY * NearestY);
+	OutFarthestDistance = FMath::Sqrt(FarthestX * FarthestX + FarthestY * FarthestY);
+}
+
+void FMeshQuadTree::FTraversalContext::BuildHorizon()
+{
+	constexpr float BinsPerRadian = NumHorizonBins / (2.0f * UE_PI);
+	HorizonObserverZ = static_cast<float>(TraversalDesc.ObserverPosition.Z - Origin.Z);
+
+	for (const FBox& Occluder : TraversalDesc.HorizonOccluders)
+	{
+		// Tiles are above the bottom of the tree. A ray from an observer above the bottom of the occluder to them can't pass under it
+		if (!Occluder.IsValid || Occluder.Min.Z > Origin.Z || Occluder.Min.Z > TraversalDesc.ObserverPosition.Z)
+		{
+			continue;
+		}
+
+		const FVector2f OccluderMin = FVector2f((FVector2D(Occluder.Min) - FVector2D(Origin)) / LeafSize);
+		const FVector2f OccluderMax = FVector2f((FVector2D(Occluder.Max) - FVector2D(Origin)) / LeafSize);
+		float MinAzimuth, MaxAzimuth;
+		if (!GetAzimuthRange(OccluderMin, OccluderMax, ObserverPosition, MinAzimuth, MaxAzimuth))
+		{
+			continue;
+		}
+
+		// Lowest elevation of the top of the occluder: at its farthest point when it is above the observer, at its nearest one otherwise
+		float NearestDistance, FarthestDistance;
+		GetDistanceRange(OccluderMin, OccluderMax, ObserverPosition, NearestDistance, FarthestDistance);
+		const float TopHeight = static_cast<float>(Occluder.Max.Z - TraversalDesc.ObserverPosition.Z);
+		const float Tangent = TopHeight / (TopHeight > 0.0f ? FarthestDistance : NearestDistance);
+
+		if (HorizonBins.IsEmpty())
+		{
+			HorizonBins.Init({ -MAX_flt, 0.0f }, NumHorizonBins);
+		}
+
+		// Only the bins the occluder fully covers. The azimuths are within a turn of -PI, so one wrap is enough
+		const int32 FirstBin = FMath::CeilToInt32((MinAzimuth + UE_PI) * BinsPerRadian);
+		const int32 LastBin = FMath::FloorToInt32((MaxAzimuth + UE_PI) * BinsPerRadian) - 1;
+		for (int32 Bin = FirstBin; Bin <= LastBin; Bin++)
+		{
+			FHorizonBin& HorizonBin = HorizonBins[(Bin + NumHorizonBins) % NumHorizonBins];
+			if (Tangent > HorizonBin.Tangent)
 			{
-				if (ChildIndex > 0)
-				{
-					InNodeData.Nodes[ChildIndex].SelectLODRefinement(InNodeData, InDensityLevel + 1, InLODLevel, InTraversalDesc, Output);
-				}
+				HorizonBin.Tangent = Tangent;
+				HorizonBin.Distance = FarthestDistance;
 			}
 		}
 	}
 }
 
-void FMeshQuadTree::FNode::SelectLOD(const FNodeData& InNodeData, int32 InLODLevel,
-                                     const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const
+bool FMeshQuadTree::FTraversalContext::IsBehindHorizon(const FTraversalItem& InItem) const
 {
-	const FQuadtreeMeshRenderData& QuadtreeMeshRenderData = InNodeData.QuadtreeMeshRenderData[QuadtreeMeshIndex];
-	const FVector CenterPosition = Bounds.GetCenter();
-	const FVector Extent = Bounds.GetExtent();
+	constexpr float BinsPerRadian = NumHorizonBins / (2.0f * UE_PI);
 
-	// Early out on frustum culling 
-	if (!InTraversalDesc.Frustum.IntersectBox(CenterPosition, Extent))
+	const FVector2f TileMin(InItem.TileX, InItem.TileY);
+	const FVector2f TileMax = TileMin + FVector2f(static_cast<float>(1u << InItem.Level));
+	float MinAzimuth, MaxAzimuth;
+	if (!GetAzimuthRange(TileMin, TileMax, ObserverPosition, MinAzimuth, MaxAzimuth))
 	{
-		// Handled
-		return;
+		return false;
+	}
+
+	// The lowest horizon of the bins the item overlaps, which only hides what is beyond all the occluders that make it
+	float HorizonTangent = MAX_flt;
+	float HorizonDistance = 0.0f;
+	const int32 FirstBin = FMath::FloorToInt32((MinAzimuth + UE_PI) * BinsPerRadian);
+	const int32 LastBin = FMath::FloorToInt32((MaxAzimuth + UE_PI) * BinsPerRadian);
+	for (int32 Bin = FirstBin; Bin <= LastBin; Bin++)
+	{
+		const FHorizonBin& HorizonBin = HorizonBins[(Bin + NumHorizonBins) % NumHorizonBins];
+		if (HorizonBin.Tangent == -MAX_flt)
+		{
+			return false;
+		}
+		HorizonTangent = FMath::Min(HorizonTangent, HorizonBin.Tangent);
+		HorizonDistance = FMath::Max(HorizonDistance, HorizonBin.Distance);
+	}
+
+	float NearestDistance, FarthestDistance;
+	GetDistanceRange(TileMin, TileMax, ObserverPosition, NearestDistance, FarthestDistance);
+	if (NearestDistance < HorizonDistance)
+	{
+		return false;
+	}
+
+	// Highest elevation of the item: its top at the nearest point when it is above the observer, at the farthest one otherwise. Implicit children share the Z range of their node
+	const FNode& Node = NodeData.Nodes[InItem.NodeIndex];
+	const float TopHeight = static_cast<float>(Node.QuantizedMaxZ) * ZStep - HorizonObserverZ;
+	const float Tangent = TopHeight / (TopHeight > 0.0f ? NearestDistance : FarthestDistance);
+	return Tangent <= HorizonTangent;
+}
+
+uint32 FMeshQuadTree::FTraversalContext::CullItemsBehindHorizon(const FTraversalItem* InItems, uint32 InVisibleMask) const
+{
+	uint32 VisibleMask = InVisibleMask;
+	for (uint32 Mask = InVisibleMask; Mask != 0; Mask &= Mask - 1)
+	{
+		const uint32 ItemIndex = FMath::CountTrailingZeros(Mask);
+		if (IsBehindHorizon(InItems[ItemIndex]))
+		{
+			VisibleMask &= ~(1u << ItemIndex);
+		}
 	}
+	return VisibleMask;
+}
 
-	// Distance to tile (if 0, position is inside quad)
-	FBox2D Bounds2D(FVector2D(Bounds.Min), FVector2D(Bounds.Max));
-	const float ClosestDistanceToTile = FMath::Sqrt(Bounds2D.ComputeSquaredDistanceToPoint(FVector2D(InTraversalDesc.ObserverPosition)));
+void FMeshQuadTree::FTraversalContext::BuildFootprintPlanes(double InSlabHeight, double InRootSizeInTiles)
+{
+	// A shared traversal covers the union of its frusta, whose footprint is contained in the convex hull of their individual footprints
+	const TConstArrayView<FConvexVolume> Frusta = (TraversalDesc.UnionFrusta.Num() > 0) ? MakeArrayView(TraversalDesc.UnionFrusta) : MakeArrayView(&TraversalDesc.Frustum, 1);
 
-	// If quad is outside this LOD range, it belongs to the LOD above, assume it fits in that LOD and drill down to find renderable nodes
-	if (ClosestDistanceToTile > GetLODDistance(InLODLevel, InTraversalDesc.LODScale))
+	const double RootSize = InRootSizeInTiles * LeafSize;
+	const double Tolerance = UE_KINDA_SMALL_NUMBER * FMath::Max(RootSize, InSlabHeight);
+	TArray<FVector2D, TInlineAllocator<64>> Corners;
+	for (const FConvexVolume& Frustum : Frusta)
 	{
-		// This node is capable of representing all its leaf nodes, so just submit this node
-		if (CanRender(0, InTraversalDesc.ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+		// Everything that can be rendered is inside these half spaces, relative to Origin: the frustum, the Z slab and the XY region of the tree
+		TArray<FPlane, TInlineAllocator<12>> HalfSpaces;
+		for (const FPlane& Plane : Frustum.Planes)
 		{
-			AddNodeForRender(InNodeData, QuadtreeMeshRenderData, 1, InLODLevel + 1, InTraversalDesc, Output);
+			HalfSpaces.Add(FPlane(Plane.X, Plane.Y, Plane.Z, -Plane.PlaneDot(Origin)));
 		}
-		else
+		HalfSpaces.Add(FPlane(0.0, 0.0, 1.0, InSlabHeight));
+		HalfSpaces.Add(FPlane(0.0, 0.0, -1.0, 0.0));
+		HalfSpaces.Add(FPlane(1.0, 0.0, 0.0, RootSize));
+		HalfSpaces.Add(FPlane(-1.0, 0.0, 0.0, 0.0));
+		HalfSpaces.Add(FPlane(0.0, 1.0, 0.0, RootSize));
+		HalfSpaces.Add(FPlane(0.0, -1.0, 0.0, 0.0));
+
+		// The corners of the clipped frustum are the intersections of three boundaries that are inside all the other half spaces
+		for (int32 i = 0; i < HalfSpaces.Num(); i++)
 		{
-			// If not, we need to recurse down the children until we find one that can be rendered
-			for (int32 ChildIndex : Children)
+			for (int32 j = i + 1; j < HalfSpaces.Num(); j++)
 			{
-				if (ChildIndex > 0)
+				for (int32 k = j + 1; k < HalfSpaces.Num(); k++)
 				{
-					InNodeData.Nodes[ChildIndex].SelectLODRefinement(InNodeData, 2, InLODLevel + 1, InTraversalDesc, Output);
+					FVector Corner;
+					if (!FMath::IntersectPlanes3(Corner, HalfSpaces[i], HalfSpaces[j], HalfSpaces[k]))
+					{
+						continue;
+					}
+
+					bool bInside = true;
+					for (int32 m = 0; m < HalfSpaces.Num() && bInside; m++)
+					{
+						bInside = HalfSpaces[m].PlaneDot(Corner) <= Tolerance;
+					}
+					if (bInside)
+					{
+						Corners.Add(FVector2D(Corner) / LeafSize);
+					}
 				}
 			}
 		}
+	}
 
-		// Handled
+	if (Corners.IsEmpty())
+	{
+		bEmptyFootprint = true;
 		return;
 	}
 
-	// Last LOD, simply add node
-	if (InLODLevel == 0)
+	// Convex hull of the corners on XY, counter clockwise (monotone chain)
+	Corners.Sort([](const FVector2D& A, const FVector2D& B) { return A.X < B.X || (A.X == B.X && A.Y < B.Y); });
+	TArray<FVector2D, TInlineAllocator<64>> Hull;
+	Hull.SetNumUninitialized(2 * Corners.Num());
+	int32 HullCount = 0;
+	for (int32 Pass = 0; Pass < 2; Pass++)
 	{
-		if (CanRender(0, InTraversalDesc.ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+		const int32 ChainStart = HullCount;
+		for (int32 Index = 0; Index < Corners.Num(); Index++)
 		{
-			AddNodeForRender(InNodeData, QuadtreeMeshRenderData, 0, InLODLevel, InTraversalDesc, Output);
+			const FVector2D& Corner = Corners[Pass == 0 ? Index : Corners.Num() - 1 - Index];
+			while (HullCount >= ChainStart + 2 && FVector2D::CrossProduct(Hull[HullCount - 1] - Hull[HullCount - 2], Corner - Hull[HullCount - 2]) <= UE_KINDA_SMALL_NUMBER)
+			{
+				HullCount--;
+			}
+			Hull[HullCount++] = Corner;
 		}
+		// The last point of each chain is the first of the other one
+		HullCount--;
 	}
-	else
+
+	// A degenerate footprint can't be tested with edge normals, the 3D planes are used alone
+	const int32 FootprintPlaneCount = HullCount + 4;
+	if (HullCount < 3 || PlaneVectors.Num() + FootprintPlaneCount > 32)
+	{
+		return;
+	}
+
+	auto AddFootprintPlane = [this](const FVector2D& InNormal, double InDistance)
+	{
+		const float PlaneX = static_cast<float>(InNormal.X);
+		const float PlaneY = static_cast<float>(InNormal.Y);
+		PlaneVectors.Add({ VectorSetFloat1(PlaneX), VectorSetFloat1(PlaneY), VectorZeroFloat(), VectorSetFloat1(static_cast<float>(InDistance)),
+			VectorSetFloat1(FMath::Abs(PlaneX) + FMath::Abs(PlaneY)), VectorZeroFloat() });
+	};
+
+	// Separating axes of a convex polygon and a rectangle: the edge normals of the polygon and the axes of the rectangle, which are the bounds of the polygon
+	const int32 FirstFootprintPlane = PlaneVectors.Num();
+	FBox2D FootprintBounds(ForceInit);
+	for (int32 Index = 0; Index < HullCount; Index++)
+	{
+		const FVector2D& Start = Hull[Index];
+		const FVector2D Edge = Hull[(Index + 1) % HullCount] - Start;
+		const FVector2D Normal = FVector2D(Edge.Y, -Edge.X).GetSafeNormal();
+		AddFootprintPlane(Normal, Normal | Start);
+		FootprintBounds += Start;
+	}
+	AddFootprintPlane(FVector2D(1.0, 0.0), FootprintBounds.Max.X);
+	AddFootprintPlane(FVector2D(-1.0, 0.0), -FootprintBounds.Min.X);
+	AddFootprintPlane(FVector2D(0.0, 1.0), FootprintBounds.Max.Y);
+	AddFootprintPlane(FVector2D(0.0, -1.0), -FootprintBounds.Min.Y);
+
+	FootprintPlanesMask = ((FootprintPlaneCount + FirstFootprintPlane < 32) ? (1u << (FootprintPlaneCount + FirstFootprintPlane)) - 1 : ~0u) & ~FrustumPlanesMask;
+}
+
+template<typename TPolicy>
+bool FMeshQuadTree::FTraversalContext::MakeRootItem(FTraversalItem& OutRootItem) const
+{
+	const FNode& RootNode = NodeData.Nodes[0];
+	OutRootItem.NodeIndex = 0;
+	OutRootItem.TileX = RootNode.TileX;
+	OutRootItem.TileY = RootNode.TileY;
+	OutRootItem.Level = static_cast<uint8>(RootNode.Level);
+	OutRootItem.LODLevel = static_cast<uint8>(TreeDepth);
+	OutRootItem.DensityLevel = 0;
+	OutRootItem.Mode = ETraversalMode::SelectLOD;
+
+	// Nodes are culled by their parent together with their siblings, only the root is tested on its own
+	return !bEmptyFootprint && CullItems4<TPolicy>(&OutRootItem, 1, AllPlanesMask, true) != 0;
+}
+
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::Traverse(const FTraversalItem& InRootItem, FTraversalOutput& Output) const
+{
+	const int32 ForceCollapseDensityLevel = TraversalDesc.ForceCollapseDensityLevel;
+
+	FTraversalStack Stack;
+	Stack.Push(InRootItem);
+
+	while (!Stack.IsEmpty())
 	{
-		// This quad is fully inside its LOD (also qualifies if it's simply the lowest LOD)
-		if (ClosestDistanceToTile > GetLODDistance(InLODLevel - 1, InTraversalDesc.LODScale) || InLODLevel == InTraversalDesc.LowestLOD)
+		const FTraversalItem Item = Stack.Pop();
+		const FNode& Node = NodeData.Nodes[Item.NodeIndex];
+		const FQuadtreeMeshRenderData& QuadtreeMeshRenderData = NodeData.QuadtreeMeshRenderData[Node.QuadtreeMeshIndex];
+		const int32 LODLevel = Item.LODLevel;
+
+		switch (Item.Mode)
 		{
-			// This node is capable of representing all its leaf nodes, so just submit this node
-			if (CanRender(0, InTraversalDesc.ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+		case ETraversalMode::SelectLOD:
+		case ETraversalMode::SelectLODCoarse:
+			// If quad is outside this LOD range, it belongs to the LOD above, assume it fits in that LOD and drill down to find renderable nodes
+			if (Item.SquaredDistance > GetSquaredLODDistance(LODLevel))
 			{
-				AddNodeForRender(InNodeData, QuadtreeMeshRenderData, 0, InLODLevel, InTraversalDesc, Output);
+				// This node is capable of representing all its leaf nodes, so just submit this node
+				if (Node.CanRender(0, ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+				{
+					AddNodeForRender<TPolicy>(Item, Node, QuadtreeMeshRenderData, 1, LODLevel + 1, Output);
+				}
+				else
+				{
+					// If not, we need to recurse down the children until we find one that can be rendered
+					PushVisibleChildren<TPolicy>(Item, false, ETraversalMode::SelectLODRefinement, LODLevel + 1, 2, Stack);
+				}
 			}
-			else
+			// Last LOD, simply add node
+			else if (LODLevel == 0)
 			{
-				// If not, we need to recurse down the children until we find one that can be rendered
-				for (int32 ChildIndex : Children)
+				if (Node.CanRender(0, ForceCollapseDensityLevel, QuadtreeMeshRenderData))
 				{
-					if (ChildIndex > 0)
-					{
-						InNodeData.Nodes[ChildIndex].SelectLODRefinement(InNodeData, 1, InLODLevel, InTraversalDesc, Output);
-					}
+					AddNodeForRender<TPolicy>(Item, Node, QuadtreeMeshRenderData, 0, LODLevel, Output);
 				}
 			}
-		}
-		else
-		{
-			// If this node has a complete subtree it will not contain any actual children, they are implicit to save memory so we generate them here
-			if (HasCompleteSubtree && IsSubtreeSameQuadtreeMesh)
+			// This quad is fully inside its LOD (also qualifies if it's simply the lowest LOD). Coarse nodes stop here in any case
+			else if (Item.SquaredDistance > GetSquaredLODDistance(LODLevel - 1) || LODLevel == TraversalDesc.LowestLOD || Item.Mode == ETraversalMode::SelectLODCoarse)
 			{
-				FNode ChildNode;
-				const FVector HalfBoundSize(Extent.X, Extent.Y, Extent.Z*2.0f);
-				const FVector HalfOffsets[] = { {0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f} , {0.0f, 1.0f, 0.0f} , {1.0f, 1.0f, 0.0f} };
-				for (int i = 0; i < 4; i++)
+				// This node is capable of representing all its leaf nodes, so just submit this node
+				if (Node.CanRender(0, ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+				{
+					AddNodeForRender<TPolicy>(Item, Node, QuadtreeMeshRenderData, 0, LODLevel, Output);
+				}
+				else
 				{
-					const FVector ChildMin = Bounds.Min + HalfBoundSize * HalfOffsets[i];
-					const FVector ChildMax = ChildMin + HalfBoundSize;
-					const FBox ChildBounds(ChildMin, ChildMax);
-
-					// Create a temporary node to traverse
-					ChildNode.HasCompleteSubtree = 1;
-					ChildNode.IsSubtreeSameQuadtreeMesh = 1;
-					ChildNode.TransitionQuadtreeMeshIndex = TransitionQuadtreeMeshIndex;
-					ChildNode.QuadtreeMeshIndex = QuadtreeMeshIndex;
-					ChildNode.Bounds = ChildBounds;
-
-					ChildNode.SelectLOD(InNodeData, InLODLevel - 1, InTraversalDesc, Output);
+					// If not, we need to recurse down the children until we find one that can be rendered
+					PushVisibleChildren<TPolicy>(Item, false, ETraversalMode::SelectLODRefinement, LODLevel, 1, Stack);
 				}
 			}
+			else if (TraversalDesc.bAnalyticCompleteRegions && Node.HasImplicitChildren())
+			{
+				SelectLODInCompleteRegion<TPolicy>(Item, Node, QuadtreeMeshRenderData, Output);
+			}
 			else
 			{
-				for (int32 ChildIndex : Children)
-				{
-					if (ChildIndex > 0)
-					{
-						InNodeData.Nodes[ChildIndex].SelectLOD(InNodeData, InLODLevel - 1, InTraversalDesc, Output);
-					}
-				}
+				// If this node has a complete subtree it will not contain any actual children, they are implicit to save memory so we generate them here
+				PushVisibleChildren<TPolicy>(Item, true, ETraversalMode::SelectLOD, LODLevel - 1, 0, Stack);
 			}
+			break;
+
+		case ETraversalMode::SelectLODRefinement:
+			// This LOD can represent all its leaf nodes, simply add node
+			if (Node.CanRender(Item.DensityLevel, ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+			{
+				AddNodeForRender<TPolicy>(Item, Node, QuadtreeMeshRenderData, Item.DensityLevel, LODLevel, Output);
+			}
+			else
+			{
+				// If not, we need to recurse down the children until we find one that can be rendered
+				PushVisibleChildren<TPolicy>(Item, false, ETraversalMode::SelectLODRefinement, LODLevel, Item.DensityLevel + 1, Stack);
+			}
+			break;
 		}
 	}
 }
 
-void FMeshQuadTree::FNode::SelectLODWithinBounds(const FNodeData& InNodeData, int32 InLODLevel,
-                                                 const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::TraverseWithBudget(const FTraversalItem& InRootItem, FTraversalOutput& Output) const
 {
-	const FQuadtreeMeshRenderData& QuadtreeMeshRenderData = InNodeData.QuadtreeMeshRenderData[QuadtreeMeshIndex];
-	const FVector CenterPosition = Bounds.GetCenter();
-	const FVector Extent = Bounds.GetExtent();
+	TRACE_CPUPROFILER_EVENT_SCOPE(TraverseWithBudget);
 
-	// Early out on frustum culling 
-	if (!InTraversalDesc.Frustum.IntersectBox(CenterPosition, Extent))
+	struct FCost
 	{
-		// Handled
-		return;
+		int32 InstanceCount = 0;
+		int64 VertexCount = 0;
+	};
+
+	// Costs only depend on the selected tiles, count them without writing instances
+	using FCostPolicy = TTraversalPolicy<TPolicy::bCull, false, false, false, true>;
+	FTraversalOutput CostOutput;
+	auto CountCoarseCost = [this, &CostOutput, &Output](const FTraversalItem& InItem)
+	{
+		CostOutput.Reset(Output.BucketInstanceCounts.Num());
+
+		FTraversalItem CoarseItem = InItem;
+		CoarseItem.Mode = ETraversalMode::SelectLODCoarse;
+		Traverse<FCostPolicy>(CoarseItem, CostOutput);
+
+		FCost Cost;
+		Cost.InstanceCount = CostOutput.InstanceCount;
+		if (TraversalDesc.DensityVertexCounts.Num() == TraversalDesc.DensityCount)
+		{
+			for (int32 BucketIndex = 0; BucketIndex < CostOutput.BucketInstanceCounts.Num(); ++BucketIndex)
+			{
+				Cost.VertexCount += static_cast<int64>(CostOutput.BucketInstanceCounts[BucketIndex]) * TraversalDesc.DensityVertexCounts[BucketIndex % TraversalDesc.DensityCount];
+			}
+		}
+		return Cost;
+	};
+
+	auto FitsInBudget = [this](const FCost& InCost)
+	{
+		return (TraversalDesc.InstanceBudget <= 0 || InCost.InstanceCount <= TraversalDesc.InstanceBudget)
+			&& (TraversalDesc.VertexBudget <= 0 || InCost.VertexCount <= TraversalDesc.VertexBudget);
+	};
+
+	// Same condition as the split of the SelectLOD mode of Traverse
+	auto WantsRefinement = [this](const FTraversalItem& InItem)
+	{
+		return InItem.LODLevel != 0
+			&& InItem.SquaredDistance <= GetSquaredLODDistance(InItem.LODLevel - 1)
+			&& InItem.LODLevel != TraversalDesc.LowestLOD;
+	};
+
+	// Every node the refinement can reach, with its coarse cost. Each one is counted once here, so no subtree is walked again when its parent is split.
+	// A node that won't be split is counted with its whole subtree, a node that can be split only down to where it renders at its own LOD. Children of a node are contiguous
+	struct FCandidate
+	{
+		FTraversalItem Item;
+		FCost CoarseCost;
+		int32 FirstChild = INDEX_NONE;
+		int32 NumChildren = 0;
+	};
+	TArray<FCandidate> Candidates;
+	Candidates.AddDefaulted_GetRef().Item = InRootItem;
+	for (int32 CandidateIndex = 0; CandidateIndex < Candidates.Num(); ++CandidateIndex)
+	{
+		const FTraversalItem Item = Candidates[CandidateIndex].Item;
+		Candidates[CandidateIndex].CoarseCost = CountCoarseCost(Item);
+		if (!WantsRefinement(Item))
+		{
+			continue;
+		}
+
+		FTraversalStack Children;
+		PushVisibleChildren<TPolicy>(Item, true, ETraversalMode::SelectLOD, Item.LODLevel - 1, 0, Children);
+		Candidates[CandidateIndex].FirstChild = Candidates.Num();
+		Candidates[CandidateIndex].NumChildren = Children.Num;
+		for (int32 ChildIndex = 0; ChildIndex < Children.Num; ++ChildIndex)
+		{
+			Candidates.AddDefaulted_GetRef().Item = Children.Items[ChildIndex];
+		}
 	}
 
-	check(InTraversalDesc.TessellatedQuadtreeMeshBounds.bIsValid);
-	if (InLODLevel == 0)
+	struct FRefinableItem
+	{
+		int32 CandidateIndex;
+		/** Squared size over squared distance, which orders the tiles like their projected quad size */
+		float Error;
+	};
+	auto ByLargestError = [](const FRefinableItem& A, const FRefinableItem& B) { return A.Error > B.Error; };
+
+	TArray<FRefinableItem> RefinableItems;
+	TArray<FTraversalItem> CoarseItems;
+	FCost TotalCost = Candidates[0].CoarseCost;
+
+	auto AddItem = [&](int32 InCandidateIndex)
+	{
+		const FTraversalItem& Item = Candidates[InCandidateIndex].Item;
+		if (WantsRefinement(Item))
+		{
+			const float Size = static_cast<float>(1u << Item.Level);
+			RefinableItems.HeapPush({ InCandidateIndex, (Size * Size) / FMath::Max(Item.SquaredDistance, 1.0f) }, ByLargestError);
+		}
+		else
+		{
+			CoarseItems.Add(Item);
+		}
+	};
+	AddItem(0);
+
+	while (RefinableItems.Num() > 0)
 	{
-		if ((InTraversalDesc.TessellatedQuadtreeMeshBounds.IsInsideOrOn(FVector2D(Bounds.Min)) && InTraversalDesc.TessellatedQuadtreeMeshBounds.IsInsideOrOn(FVector2D(Bounds.Max))) &&
-			CanRender(0, InTraversalDesc.ForceCollapseDensityLevel, QuadtreeMeshRenderData))
+		FRefinableItem Refinable;
+		RefinableItems.HeapPop(Refinable, ByLargestError);
+		const FCandidate& Parent = Candidates[Refinable.CandidateIndex];
+
+		FCost RefinedCost = TotalCost;
+		RefinedCost.InstanceCount -= Parent.CoarseCost.InstanceCount;
+		RefinedCost.VertexCount -= Parent.CoarseCost.VertexCount;
+		for (int32 ChildIndex = Parent.FirstChild; ChildIndex < Parent.FirstChild + Parent.NumChildren; ++ChildIndex)
+		{
+			RefinedCost.InstanceCount += Candidates[ChildIndex].CoarseCost.InstanceCount;
+			RefinedCost.VertexCount += Candidates[ChildIndex].CoarseCost.VertexCount;
+		}
+
+		// Smaller errors may still fit, keep going until the queue is empty
+		if (!FitsInBudget(RefinedCost))
 		{
-			AddNodeForRender(InNodeData, QuadtreeMeshRenderData, 0, InLODLevel, InTraversalDesc, Output);
+			CoarseItems.Add(Parent.Item);
+			continue;
+		}
+
+		TotalCost = RefinedCost;
+		for (int32 ChildIndex = Parent.FirstChild; ChildIndex < Parent.FirstChild + Parent.NumChildren; ++ChildIndex)
+		{
+			AddItem(ChildIndex);
 		}
 	}
-	else
+
+	for (FTraversalItem& CoarseItem : CoarseItems)
+	{
+		CoarseItem.Mode = ETraversalMode::SelectLODCoarse;
+		Traverse<TPolicy>(CoarseItem, Output);
+	}
+}
+
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::SelectLODInCompleteRegion(const FTraversalItem& InRegionItem, const FNode& InNode, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData, FTraversalOutput& Output) const
+{
+	// Every tile of a complete subtree can render, or none can
+	if (!InNode.CanRender(0, TraversalDesc.ForceCollapseDensityLevel, InQuadtreeMeshRenderData))
+	{
+		return;
+	}
+
+	// Tiles are selected level by level, then output in the order the walk would visit them: nearest child first at each level, like PushVisibleChildren.
+	// The key of a tile is the rank of its quadrant around the observer in each of its ancestors, from the region down, padded to the leaf level.
+	// Selected tiles don't overlap, so ordering them by key is the depth first order of the walk
+	struct FSelectedTile
+	{
+		FTraversalItem Item;
+		uint64 Key;
+	};
+	TArray<FSelectedTile, TInlineAllocator<256>> SelectedTiles;
+	auto GetWalkOrderKey = [this, &InRegionItem](int64 InTileX, int64 InTileY, int32 InLevel)
 	{
-		// If this node has a complete subtree it will not contain any actual children, they are implicit to save memory so we generate them here
-		if (HasCompleteSubtree && IsSubtreeSameQuadtreeMesh)
+		uint64 Key = 0;
+		for (int32 AncestorLevel = InRegionItem.Level; AncestorLevel > InLevel; --AncestorLevel)
 		{
-			FNode ChildNode;
-			const FVector HalfBoundSize(Extent.X, Extent.Y, Extent.Z*2.0f);
-			const FVector HalfOffsets[] = { {0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f} , {0.0f, 1.0f, 0.0f} , {1.0f, 1.0f, 0.0f} };
-			for (int i = 0; i < 4; i++)
+			const int64 AncestorMask = ~((1ll << AncestorLevel) - 1);
+			const float HalfAncestorSize = static_cast<float>(1ll << (AncestorLevel - 1));
+			const float AncestorCenterX = static_cast<float>(InRegionItem.TileX + ((InTileX - InRegionItem.TileX) & AncestorMask)) + HalfAncestorSize;
+			const float AncestorCenterY = static_cast<float>(InRegionItem.TileY + ((InTileY - InRegionItem.TileY) & AncestorMask)) + HalfAncestorSize;
+			const uint32 ObserverQuadrant = (ObserverPosition.X >= AncestorCenterX ? 1u : 0u) | (ObserverPosition.Y >= AncestorCenterY ? 2u : 0u);
+			const uint32 TileQuadrant = (InTileX >= AncestorCenterX ? 1u : 0u) | (InTileY >= AncestorCenterY ? 2u : 0u);
+			Key = (Key << 2) | (TileQuadrant ^ ObserverQuadrant);
+		}
+		return Key << (2 * InLevel);
+	};
+
+	const int64 RegionSize = 1ll << InRegionItem.Level;
+	for (int32 ParentLevel = InRegionItem.Level; ParentLevel > 0; --ParentLevel)
+	{
+		const int32 ChildLevel = ParentLevel - 1;
+		const int64 ParentSize = 1ll << ParentLevel;
+		const int64 ChildSize = ParentSize >> 1;
+
+		int64 FirstX = InRegionItem.TileX;
+		int64 FirstY = InRegionItem.TileY;
+		int64 LastX = InRegionItem.TileX + RegionSize - ParentSize;
+		int64 LastY = InRegionItem.TileY + RegionSize - ParentSize;
+
+		// The region itself was split by the caller. Below it, only parents within the LOD distance of their children are split, which is a disc around the observer or a rounded box around the focus region
+		if (ParentLevel < InRegionItem.Level)
+		{
+			if (ParentLevel <= TraversalDesc.LowestLOD)
 			{
-				const FVector ChildMin = Bounds.Min + HalfBoundSize * HalfOffsets[i];
-				const FVector ChildMax = ChildMin + HalfBoundSize;
-				const FBox ChildBounds(ChildMin, ChildMax);
-
-				// Create a temporary node to traverse
-				ChildNode.HasCompleteSubtree = 1;
-				ChildNode.IsSubtreeSameQuadtreeMesh = 1;
-				ChildNode.TransitionQuadtreeMeshIndex = TransitionQuadtreeMeshIndex;
-				ChildNode.QuadtreeMeshIndex = QuadtreeMeshIndex;
-				ChildNode.Bounds = ChildBounds;
-
-				ChildNode.SelectLODWithinBounds(InNodeData, InLODLevel - 1, InTraversalDesc, Output);
+				break;
 			}
+
+			// Parents touching the bounds of that area, with one more on each side. The exact test is done per parent below
+			const float Radius = FMath::Sqrt(GetSquaredLODDistance(ChildLevel));
+			FirstX = FMath::Max(FirstX, InRegionItem.TileX + (FMath::FloorToInt64((LODRegion.Min.X - Radius - InRegionItem.TileX) / ParentSize) - 1) * ParentSize);
+			FirstY = FMath::Max(FirstY, InRegionItem.TileY + (FMath::FloorToInt64((LODRegion.Min.Y - Radius - InRegionItem.TileY) / ParentSize) - 1) * ParentSize);
+			LastX = FMath::Min(LastX, InRegionItem.TileX + (FMath::FloorToInt64((LODRegion.Max.X + Radius - InRegionItem.TileX) / ParentSize) + 1) * ParentSize);
+			LastY = FMath::Min(LastY, InRegionItem.TileY + (FMath::FloorToInt64((LODRegion.Max.Y + Radius - InRegionItem.TileY) / ParentSize) + 1) * ParentSize);
 		}
-		else
+
+		for (int64 ParentY = FirstY; ParentY <= LastY; ParentY += ParentSize)
 		{
-			for (const int32 ChildIndex : Children)
+			for (int64 ParentX = FirstX; ParentX <= LastX; ParentX += ParentSize)
 			{
-				if (ChildIndex > 0)
+				if (ParentLevel < InRegionItem.Level && !IsCompleteRegionTileSplit(ParentX, ParentY, ParentLevel))
 				{
-					InNodeData.Nodes[ChildIndex].SelectLODWithinBounds(InNodeData, InLODLevel - 1, InTraversalDesc, Output);
+					continue;
+				}
+
+				// Children that are not split themselves are selected, the others are handled on the next level
+				for (int32 ChildIndex = 0; ChildIndex < 4; ChildIndex++)
+				{
+					const int64 ChildX = ParentX + (ChildIndex & 1) * ChildSize;
+					const int64 ChildY = ParentY + (ChildIndex >> 1) * ChildSize;
+					if (IsCompleteRegionTileSplit(ChildX, ChildY, ChildLevel))
+					{
+						continue;
+					}
+
+					// Outside of its own LOD range, the tile belongs to the LOD above and renders at half density
+					const bool bInLODAbove = GetSquaredDistanceToTile(ChildX, ChildY, ChildLevel) > GetSquaredLODDistance(ChildLevel);
+
+					FSelectedTile& SelectedTile = SelectedTiles.AddDefaulted_GetRef();
+					SelectedTile.Key = GetWalkOrderKey(ChildX, ChildY, ChildLevel);
+					FTraversalItem& ChildItem = SelectedTile.Item;
+					ChildItem.NodeIndex = InRegionItem.NodeIndex;
+					ChildItem.TileX = static_cast<uint16>(ChildX);
+					ChildItem.TileY = static_cast<uint16>(ChildY);
+					ChildItem.Level = static_cast<uint8>(ChildLevel);
+					ChildItem.LODLevel = static_cast<uint8>(bInLODAbove ? ChildLevel + 1 : ChildLevel);
+					ChildItem.DensityLevel = bInLODAbove ? 1 : 0;
+					ChildItem.Mode = ETraversalMode::SelectLOD;
 				}
 			}
 		}
 	}
-}
 
-bool FMeshQuadTree::FNode::QueryBaseHeightAtLocation(const FNodeData& InNodeData, const FVector2D& InWorldLocationXY,float& OutHeight) const
-{
-	// Note: Since we prune the quadtree of anything below this condition, it means there are no more granular nodes to fetch below this. In theory we could skip the pruning and have slightly more accurate height sampling, since rivers might have leaf nodes with individual bounds.
-	// Same condition as leaf nodes
-	if (HasCompleteSubtree && IsSubtreeSameQuadtreeMesh)
-	{
-		// Return "accurate" base height when there's a valid sample
-		OutHeight = InNodeData.QuadtreeMeshRenderData[QuadtreeMeshIndex].SurfaceBaseHeight;
-		
-		return true;
-	}
+	SelectedTiles.Sort([](const FSelectedTile& A, const FSelectedTile& B) { return A.Key < B.Key; });
 
-	for (const int32 ChildIndex : Children)
+	// Selected tiles are frustum culled in groups of four. Tiles are inside their parent, so a tile that passes the test has ancestors that pass it too
+	for (int32 BatchStart = 0; BatchStart < SelectedTiles.Num(); BatchStart += 4)
 	{
-		if (ChildIndex > 0)
+		FTraversalItem Batch[4];
+		const int32 BatchCount = FMath::Min(4, SelectedTiles.Num() - BatchStart);
+		for (int32 i = 0; i < BatchCount; i++)
 		{
-			const FNode& ChildNode = InNodeData.Nodes[ChildIndex];
-			const FBox ChildBounds = ChildNode.Bounds;
+			Batch[i] = SelectedTiles[BatchStart + i].Item;
+		}
 
-			// Check if point is inside (or on the Min edges) of the child bounds
-			if ((InWorldLocationXY.X >= ChildBounds.Min.X) && (InWorldLocationXY.X < ChildBounds.Max.X)
-				&& (InWorldLocationXY.Y >= ChildBounds.Min.Y) && (InWorldLocationXY.Y < ChildBounds.Max.Y))
+		const uint32 VisibleMask = CullItems4<TPolicy>(Batch, BatchCount, InRegionItem.PlaneMask, false);
+		for (int32 i = 0; i < BatchCount; i++)
+		{
+			if (VisibleMask & (1u << i))
 			{
-				return ChildNode.QueryBaseHeightAtLocation(InNodeData, InWorldLocationXY, OutHeight);
+				AddNodeForRender<TPolicy>(Batch[i], InNode, InQuadtreeMeshRenderData, Batch[i].DensityLevel, Batch[i].LODLevel, Output);
 			}
 		}
 	}
+}
 
-	// Return regular base height when there's not valid sample
-	OutHeight = InNodeData.QuadtreeMeshRenderData[QuadtreeMeshIndex].SurfaceBaseHeight;
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::GatherTraversalTasks(const FTraversalItem& InRootItem, int32 InSplitDepth, TArray<FTraversalItem>& OutTasks) const
+{
+	FTraversalStack Stack;
+	Stack.Push(InRootItem);
 
-	// Point is not in any of these children, return false
-	return false;
+	while (!Stack.IsEmpty())
+	{
+		const FTraversalItem Item = Stack.Pop();
+		const int32 LODLevel = Item.LODLevel;
+
+		// Note: The conditions below must mirror the SelectLOD mode of Traverse. Any item that Traverse wouldn't split in SelectLOD children becomes a task as a whole
+		const bool bSelectLODInChildren = (TreeDepth - LODLevel < InSplitDepth)
+			&& (Item.SquaredDistance <= GetSquaredLODDistance(LODLevel))
+			&& (LODLevel != 0)
+			&& !(Item.SquaredDistance > GetSquaredLODDistance(LODLevel - 1) || LODLevel == TraversalDesc.LowestLOD)
+			&& !(TraversalDesc.bAnalyticCompleteRegions && NodeData.Nodes[Item.NodeIndex].HasImplicitChildren());
+
+		if (bSelectLODInChildren)
+		{
+			PushVisibleChildren<TPolicy>(Item, true, ETraversalMode::SelectLOD, LODLevel - 1, 0, Stack);
+		}
+		else
+		{
+			OutTasks.Add(Item);
+		}
+	}
 }
 
-bool FMeshQuadTree::FNode::QueryBoundsAtLocation(const FNodeData& InNodeData, const FVector2D& InWorldLocationXY,FBox& OutBounds) const
+int32 FMeshQuadTree::FTraversalContext::GetChildItems(const FTraversalItem& InItem, bool bInAllowImplicit, FTraversalItem (&OutChildren)[4]) const
 {
-	OutBounds = Bounds;
+	const FNode& Node = NodeData.Nodes[InItem.NodeIndex];
 
-	int32 ChildCount = 0;
-	for (const int32 ChildIndex : Children)
+	if (bInAllowImplicit && Node.HasImplicitChildren())
 	{
-		if (ChildIndex > 0)
+		// Implicit children share the node of their parent, only their position differs
+		const uint32 ChildSize = 1u << (InItem.Level - 1);
+		for (int32 i = 0; i < 4; i++)
 		{
-			ChildCount++;
-			const FNode& ChildNode = InNodeData.Nodes[ChildIndex];
-			const FBox ChildBounds = ChildNode.Bounds;
+			OutChildren[i].NodeIndex = InItem.NodeIndex;
+			OutChildren[i].TileX = static_cast<uint16>(InItem.TileX + (i & 1) * ChildSize);
+			OutChildren[i].TileY = static_cast<uint16>(InItem.TileY + (i >> 1) * ChildSize);
+			OutChildren[i].Level = InItem.Level - 1;
+		}
+		return 4;
+	}
 
-			// Check if point is inside (or on the Min edges) of the child bounds
-			if ((InWorldLocationXY.X >= ChildBounds.Min.X) && (InWorldLocationXY.X < ChildBounds.Max.X)
-				&& (InWorldLocationXY.Y >= ChildBounds.Min.Y) && (InWorldLocationXY.Y < ChildBounds.Max.Y))
-			{
-				return ChildNode.QueryBoundsAtLocation(InNodeData, InWorldLocationXY, OutBounds);
-			}
+	// Implicit nodes don't have stored children
+	if (InItem.IsImplicit(Node))
+	{
+		return 0;
+	}
+
+	const int32 ChildCount = Node.GetChildCount();
+	for (int32 i = 0; i < ChildCount; i++)
+	{
+		const FNode& ChildNode = NodeData.Nodes[Node.FirstChild + i];
+		OutChildren[i].NodeIndex = Node.FirstChild + i;
+		OutChildren[i].TileX = ChildNode.TileX;
+		OutChildren[i].TileY = ChildNode.TileY;
+		OutChildren[i].Level = static_cast<uint8>(ChildNode.Level);
+	}
+	return ChildCount;
+}
+
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::PushVisibleChildren(const FTraversalItem& InParent, bool bInAllowImplicit, ETraversalMode InMode, int32 InLODLevel, int32 InDensityLevel, FTraversalStack& Stack) const
+{
+	FTraversalItem Children[4];
+	const int32 ChildCount = GetChildItems(InParent, bInAllowImplicit, Children);
+	const uint32 VisibleMask = CullItems4<TPolicy>(Children, ChildCount, InParent.PlaneMask, InMode == ETraversalMode::SelectLOD);
+
+	// Children are visited nearest first, so that the instances of each bucket come out roughly front to back: the quadrant of the observer, its two neighbors, then the opposite one.
+	// Ranking the quadrants by their XOR with the quadrant of the observer gives that order, each child of a node is in a different quadrant
+	const float ParentCenterX = InParent.TileX + 0.5f * static_cast<float>(1u << InParent.Level);
+	const float ParentCenterY = InParent.TileY + 0.5f * static_cast<float>(1u << InParent.Level);
+	const uint32 ObserverQuadrant = (ObserverPosition.X >= ParentCenterX ? 1u : 0u) | (ObserverPosition.Y >= ParentCenterY ? 2u : 0u);
+
+	int32 ChildIndexPerRank[4] = { INDEX_NONE, INDEX_NONE, INDEX_NONE, INDEX_NONE };
+	for (uint32 Mask = VisibleMask; Mask != 0; Mask &= Mask - 1)
+	{
+		const int32 ChildIndex = FMath::CountTrailingZeros(Mask);
+		const uint32 ChildQuadrant = (Children[ChildIndex].TileX >= ParentCenterX ? 1u : 0u) | (Children[ChildIndex].TileY >= ParentCenterY ? 2u : 0u);
+		ChildIndexPerRank[ChildQuadrant ^ ObserverQuadrant] = ChildIndex;
+	}
+
+	// Farthest child first, so that the nearest one is popped first
+	for (int32 Rank = 3; Rank >= 0; --Rank)
+	{
+		if (ChildIndexPerRank[Rank] == INDEX_NONE)
+		{
+			continue;
 		}
+
+		FTraversalItem& ChildItem = Children[ChildIndexPerRank[Rank]];
+		ChildItem.LODLevel = static_cast<uint8>(InLODLevel);
+		ChildItem.DensityLevel = static_cast<uint8>(InDensityLevel);
+		ChildItem.Mode = InMode;
+		Stack.Push(ChildItem);
 	}
+}
 
-	// No children, this is a leaf node, return true. Otherwise reaching here means none of the children contain the sampling location, so return false
-	return ChildCount == 0;
+
+bool FMeshQuadTree::FNode::CanRender(int32 InDensityLevel, int32 InForceCollapseDensityLevel,
+                                     const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData) const
+{
+	return InQuadtreeMeshRenderData.Material && IsSubtreeSameQuadtreeMesh && ((InDensityLevel > InForceCollapseDensityLevel) || HasCompleteSubtree);
 }
 
-void FMeshQuadTree::FNode::AddNodes(FNodeData& InNodeData, const FBox& InMeshBounds, const FBox& InQuadtreeMeshBounds,
-                                    uint32 InQuadtreeMeshIndex, int32 InLODLevel, uint32 InParentIndex)
+const FMeshQuadTree::FNode* FMeshQuadTree::FNode::FindChildAtLocation(const FNodeData& InNodeData, const FVector2D& InTileLocationXY) const
+{
+	const uint32 EndChild = FirstChild + GetChildCount();
+	for (uint32 ChildIndex = FirstChild; ChildIndex < EndChild; ++ChildIndex)
+	{
+		const FNode& ChildNode = InNodeData.Nodes[ChildIndex];
+		const double ChildSize = ChildNode.GetSizeInTiles();
+
+		// Check if point is inside (or on the Min edges) of the child bounds
+		if ((InTileLocationXY.X >= ChildNode.TileX) && (InTileLocationXY.X < ChildNode.TileX + ChildSize)
+			&& (InTileLocationXY.Y >= ChildNode.TileY) && (InTileLocationXY.Y < ChildNode.TileY + ChildSize))
+		{
+			return &ChildNode;
+		}
+	}
+	return nullptr;
+}
+
+void FMeshQuadTree::FBuildNode::AddNodes(FNodeData& InNodeData, const FBox& InMeshBounds, const FBox& InQuadtreeMeshBounds,
+                                         uint32 InQuadtreeMeshIndex, int32 InLODLevel, uint32 InParentIndex)
 {
 	// Update the bounds
 	Bounds.Max.Z = FMath::Max(Bounds.Max.Z, InQuadtreeMeshBounds.Max.Z);
@@ -563,15 +1666,15 @@ void FMeshQuadTree::FNode::AddNodes(FNodeData& InNodeData, const FBox& InMeshBou
 
 	const FVector2D HalfBoundSize = FVector2D(Bounds.GetSize()) * 0.5f;
 
-	FNode PrevChildNode = InNodeData.Nodes[0];
+	FBuildNode PrevChildNode = InNodeData.BuildNodes[0];
 	const FVector2D HalfOffsets[] = { {0.0f, 0.0f}, {1.0f, 0.0f} , {0.0f, 1.0f} , {1.0f, 1.0f} };
 	for (int32 i = 0; i < 4; i++)
 	{
 		if (Children[i] > 0)
 		{
-			if (InNodeData.Nodes[Children[i]].Bounds.IntersectXY(InQuadtreeMeshBounds))
+			if (InNodeData.BuildNodes[Children[i]].Bounds.IntersectXY(InQuadtreeMeshBounds))
 			{
-				InNodeData.Nodes[Children[i]].AddNodes(InNodeData, InMeshBounds, InQuadtreeMeshBounds, InQuadtreeMeshIndex, InLODLevel - 1, Children[i]);
+				InNodeData.BuildNodes[Children[i]].AddNodes(InNodeData, InMeshBounds, InQuadtreeMeshBounds, InQuadtreeMeshIndex, InLODLevel - 1, Children[i]);
 			}
 		}
 		else
@@ -584,17 +1687,17 @@ void FMeshQuadTree::FNode::AddNodes(FNodeData& InNodeData, const FBox& InMeshBou
 			if (ChildBounds.IntersectXY(InQuadtreeMeshBounds) && ChildBounds.IntersectXY(InMeshBounds))
 			{
 				// All nodes have been allocated upfront, no reallocation should occur : 
-				check(InNodeData.Nodes.Num() < InNodeData.Nodes.Max());
-				Children[i] = InNodeData.Nodes.Emplace();
-				InNodeData.Nodes[Children[i]].Bounds = ChildBounds; 
-				InNodeData.Nodes[Children[i]].ParentIndex = InParentIndex;
-				InNodeData.Nodes[Children[i]].AddNodes(InNodeData, InMeshBounds, InQuadtreeMeshBounds, InQuadtreeMeshIndex, InLODLevel - 1, Children[i]);
+				check(InNodeData.BuildNodes.Num() < InNodeData.BuildNodes.Max());
+				Children[i] = InNodeData.BuildNodes.Emplace();
+				InNodeData.BuildNodes[Children[i]].Bounds = ChildBounds;
+				InNodeData.BuildNodes[Children[i]].ParentIndex = InParentIndex;
+				InNodeData.BuildNodes[Children[i]].AddNodes(InNodeData, InMeshBounds, InQuadtreeMeshBounds, InQuadtreeMeshIndex, InLODLevel - 1, Children[i]);
 			}
 		}
 
 		if (Children[i] > 0)
 		{
-			const FNode& ChildNode = InNodeData.Nodes[Children[i]];
+			const FBuildNode& ChildNode = InNodeData.BuildNodes[Children[i]];
 
 			// If INVALID_PARENT, compare against current since there are no previous children
 			PrevChildNode = (PrevChildNode.ParentIndex == INVALID_PARENT ? ChildNode : PrevChildNode);
@@ -619,61 +1722,60 @@ void FMeshQuadTree::FNode::AddNodes(FNodeData& InNodeData, const FBox& InMeshBou
 	}
 }
 
-void FMeshQuadTree::FNode::AddNodeForRender(const FNodeData& InNodeData,
+template<typename TPolicy>
+void FMeshQuadTree::FTraversalContext::AddNodeForRender(const FTraversalItem& InItem, const FNode& InNode,
 	const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData, int32 InDensityLevel, int32 InLODLevel,
-	const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const
+	FTraversalOutput& Output) const
 {
+	const FTraversalDesc& InTraversalDesc = TraversalDesc;
 	constexpr int32 MaterialIndex = 0;
 	constexpr  uint32 NodeQuadtreeMeshIndex = 2;
 	
 
-	// The base height of this tile comes either the top of the bounding box (for rivers) or the given base height (lakes and ocean)
-	const double BaseHeight = InQuadtreeMeshRenderData.SurfaceBaseHeight;
+	// The base height of this tile comes either the top of the bounding box (for rivers) or the given base height (lakes and ocean). Stored above the tree origin, like the tile
+	const float BaseHeight = static_cast<float>(InQuadtreeMeshRenderData.SurfaceBaseHeight - MinZ);
 
-	const float BaseHeightTWS = BaseHeight + InTraversalDesc.PreViewTranslation.Z;
-
-	const int32 DensityIndex = FMath::Min(InDensityLevel, InTraversalDesc.DensityCount - 1);
+	const int32 DensityIndex = FMath::Clamp(InDensityLevel, InTraversalDesc.MinDensityLevel, InTraversalDesc.DensityCount - 1);
 	const int32 BucketIndex = MaterialIndex * InTraversalDesc.DensityCount + DensityIndex;
 	
 	++Output.BucketInstanceCounts[BucketIndex];
 
-	FVector BoundsCenter = Bounds.GetCenter();
-	FVector TranslatedWorldPosition(BoundsCenter + InTraversalDesc.PreViewTranslation);
-	
-	
-	const FVector2D Scale(Bounds.GetSize());
-	FStagingInstanceData& StagingData = Output.StagingInstanceData[Output.StagingInstanceData.AddUninitialized()];
+	if constexpr (TPolicy::bCountOnly)
+	{
+		++Output.InstanceCount;
+		return;
+	}
 
-	// Add the data to the bucket
-	StagingData.BucketIndex = BucketIndex;
-	StagingData.Data[0].X = TranslatedWorldPosition.X;
-	StagingData.Data[0].Y = TranslatedWorldPosition.Y;
-	StagingData.Data[0].Z = BaseHeightTWS;
-	//StagingData.Data[0].W = *(float*)&NodeQuadtreeMeshIndex;
-	StagingData.Data[0].W = std::bit_cast<float>(NodeQuadtreeMeshIndex);
+	// Add the data to the bucket, each stream at the end of its own array
+	FBucketInstanceData& Bucket = Output.BucketInstanceData[BucketIndex];
+	FVector4f& Data0 = Bucket.Streams[0][Bucket.Streams[0].AddUninitialized()];
+
+	// The tile stays in integer leaf tiles, the vertex factory scales it by the leaf size and adds the tree origin
+	const uint32 PackedTile = static_cast<uint32>(InItem.TileX) | (static_cast<uint32>(InItem.TileY) << 16);
+	Data0.X = std::bit_cast<float>(PackedTile);
+	Data0.Y = BaseHeight;
 
 	// Lowest LOD isn't always 0, this increases with the height distance 
 	const bool bIsLowestLOD = (InLODLevel == InTraversalDesc.LowestLOD);
 
 	// Only allow a tile to morph if it's not the last density level and not the last LOD level, sicne there is no next level to morph to
-	const uint32 bShouldMorph = (InTraversalDesc.bLODMorphingEnabled && (DensityIndex != InTraversalDesc.DensityCount - 1)) ? 1 : 0;
+	const uint32 bShouldMorph = (TPolicy::bMorph && (DensityIndex != InTraversalDesc.DensityCount - 1)) ? 1 : 0;
 	// Tiles can morph twice to be able to morph between 3 LOD levels. Next to last density level can only morph once
 	const uint32 bCanMorphTwice = (DensityIndex < InTraversalDesc.DensityCount - 2) ? 1 : 0;
 
-	// Pack some of the data to save space. LOD level in the lower 8 bits and then bShouldMorph in the 9th bit and bCanMorphTwice in the 10th bit
-	const uint32 BitPackedChannel = (static_cast<uint32>(InLODLevel) & 0xFF) | (bShouldMorph << 8) | (bCanMorphTwice << 9);
-
-	// Should morph
-	//StagingData.Data[1].X = *(float*)&BitPackedChannel;
-	StagingData.Data[1].X = std::bit_cast<float>(BitPackedChannel);
-	StagingData.Data[1].Y = bIsLowestLOD ? InTraversalDesc.HeightMorph : 0.0f;
-	StagingData.Data[1].Z = Scale.X;
-	StagingData.Data[1].W = Scale.Y;
+	// Pack some of the data to save space. LOD level in the lower 8 bits and then bShouldMorph in the 9th bit and bCanMorphTwice in the 10th bit. The tile level, the scale as a power of two
+	// of the leaf size, goes in bits 10 to 14, the signed LOD bias of the view in bits 16 to 23 and the wave param index in the upper 8 bits
+	const uint32 BitPackedChannel = (static_cast<uint32>(InLODLevel) & 0xFF) | (bShouldMorph << 8) | (bCanMorphTwice << 9) | ((static_cast<uint32>(InItem.Level) & 0x1F) << 10)
+		| ((static_cast<uint32>(InTraversalDesc.LODBias) & 0xFF) << 16) | (NodeQuadtreeMeshIndex << 24);
 
+	Data0.Z = std::bit_cast<float>(BitPackedChannel);
+	Data0.W = bIsLowestLOD ? InTraversalDesc.HeightMorph : 0.0f;
 
+#if WITH_EDITOR
 	// Instance Hit Proxy ID
+	FVector4f& Data1 = Bucket.Streams[1][Bucket.Streams[1].AddUninitialized()];
 	FLinearColor HitProxyColor;
-	if(InQuadtreeMeshRenderData.HitProxy)
+	if(TPolicy::bHitProxies && InQuadtreeMeshRenderData.HitProxy)
 	{
 		HitProxyColor = InQuadtreeMeshRenderData.HitProxy->Id.GetColor().ReinterpretAsLinear();
 	}
@@ -681,10 +1783,11 @@ void FMeshQuadTree::FNode::AddNodeForRender(const FNodeData& InNodeData,
 	{
 		HitProxyColor = FLinearColor::Black;
 	}
-	StagingData.Data[2].X = HitProxyColor.R;
-	StagingData.Data[2].Y = HitProxyColor.G;
-	StagingData.Data[2].Z = HitProxyColor.B;
-	StagingData.Data[2].W = InQuadtreeMeshRenderData.bQuadtreeMeshSelected ? 1.0f : 0.0f;
+	Data1.X = HitProxyColor.R;
+	Data1.Y = HitProxyColor.G;
+	Data1.Z = HitProxyColor.B;
+	Data1.W = InQuadtreeMeshRenderData.bQuadtreeMeshSelected ? 1.0f : 0.0f;
+#endif
 
 
 	++Output.InstanceCount;
@@ -692,7 +1795,7 @@ void FMeshQuadTree::FNode::AddNodeForRender(const FNodeData& InNodeData,
 #if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
 	// Debug drawing
 	
-	if (InTraversalDesc.DebugShowTile != 0)
+	if constexpr (TPolicy::bDebug)
 	{
 		FColor Color;
 		if (InTraversalDesc.DebugShowTile == 1)
@@ -711,7 +1814,10 @@ void FMeshQuadTree::FNode::AddNodeForRender(const FNodeData& InNodeData,
 			Color = GColorList.GetFColorByIndex(DensityIndex + 1);
 		}
 
-		DrawWireBox(InTraversalDesc.DebugPDI, Bounds.ExpandBy(FVector(-20.0f, -20.0f, 0.0f)), Color, SDPG_World);
+		const FVector BoundsMin = Origin + FVector(FVector2D(InItem.TileX, InItem.TileY) * LeafSize, InNode.QuantizedMinZ * static_cast<double>(ZStep));
+		const double NodeWorldSize = static_cast<double>(1u << InItem.Level) * LeafSize;
+		const FVector BoundsMax = FVector(FVector2D(BoundsMin) + FVector2D(NodeWorldSize), Origin.Z + InNode.QuantizedMaxZ * static_cast<double>(ZStep));
+		DrawWireBox(InTraversalDesc.DebugPDI, FBox(BoundsMin, BoundsMax).ExpandBy(FVector(-20.0f, -20.0f, 0.0f)), Color, SDPG_World);
 	}
 #endif
 }
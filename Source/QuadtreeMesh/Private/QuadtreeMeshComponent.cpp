@@ -4,6 +4,7 @@
 
 #include "DataDrivenShaderPlatformInfo.h"
 #include "QuadtreeMeshSceneProxy.h"
+#include "QuadtreeMeshRender.h"
 #include "EngineUtils.h"
 #include "MaterialDomain.h"
 #include "PSOPrecacheMaterial.h"
@@ -19,6 +20,8 @@ UQuadtreeMeshComponent::UQuadtreeMeshComponent()
 	bHasPerInstanceHitProxies = true;
 	
 	SetMobility(EComponentMobility::Static);
+	// Opt in, the shadow depth views get a traversal of their own
+	CastShadow = false;
 	struct FConstructorStatics
 	{
 		ConstructorHelpers::FObjectFinder<UMaterialInterface> DefaultMaterial;
@@ -34,6 +37,20 @@ UQuadtreeMeshComponent::UQuadtreeMeshComponent()
 	ExtentInTiles = FIntPoint(64,64);
 	LODScale = 1.0f;
 	LODLayer = 4;
+
+	// Secondary views default to coarser tiles than the main view
+	auto AddViewPolicy = [this](EQuadtreeMeshViewType InViewType, int32 InLODBias, int32 InMinDensityLevel)
+	{
+		FQuadtreeMeshViewPolicy& ViewPolicy = ViewPolicies.Add(InViewType);
+		ViewPolicy.LODBias = InLODBias;
+		ViewPolicy.MinDensityLevel = InMinDensityLevel;
+	};
+	AddViewPolicy(EQuadtreeMeshViewType::Main, 0, 0);
+	AddViewPolicy(EQuadtreeMeshViewType::SceneCapture, -1, 1);
+	AddViewPolicy(EQuadtreeMeshViewType::PlanarReflection, -1, 1);
+	AddViewPolicy(EQuadtreeMeshViewType::ReflectionCapture, -2, 2);
+	AddViewPolicy(EQuadtreeMeshViewType::Thumbnail, -2, 2);
+	AddViewPolicy(EQuadtreeMeshViewType::Shadow, -2, 2);
 }
 
 
@@ -56,6 +73,12 @@ FPrimitiveSceneProxy* UQuadtreeMeshComponent::CreateSceneProxy()
 {
 	if(RHISupportsManualVertexFetch(GMaxRHIShaderPlatform))
 	{
+		// The extension launches the traversal of the proxy as soon as a view family of the world starts rendering
+		if (!QuadtreeMeshViewExtension.IsValid() && GetWorld())
+		{
+			QuadtreeMeshViewExtension = FSceneViewExtensions::NewExtension<FQuadtreeMeshViewExtension>(GetWorld());
+		}
+
 		SceneProxy = new FQuadtreeMeshSceneProxy(this);
 		return SceneProxy;
 	}
@@ -216,7 +239,7 @@ void UQuadtreeMeshComponent::RebuildQuadtreeMesh(float InTileSize, const FIntPoi
 	const FVector2D WorldExtent = FVector2D(InTileSize * InExtentInTiles.X, InTileSize * InExtentInTiles.Y);
 
 	const FBox2D MeshWorldBox = FBox2D(-WorldExtent + GridPosition, WorldExtent + GridPosition);
-	MeshQuadTree.InitTree(MeshWorldBox,InTileSize, InExtentInTiles,false);
+	MeshQuadTree.InitTree(MeshWorldBox,InTileSize, InExtentInTiles,bUseGPUTraversal);
 
 	
 	FVector ComponentLocation = GetComponentLocation();
@@ -273,12 +296,19 @@ void UQuadtreeMeshComponent::PostEditChangeProperty(FPropertyChangedEvent& Prope
 	
 	if (PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, ForceCollapseDensityLevel)
 		|| PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, TessellationFactor)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, bUseGPUTraversal)
 		)
 	{
 		MarkQuadtreeMeshGridDirty();
 		MarkRenderStateDirty();
 	}
 
+	if (PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, ViewPolicies)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, HorizonOccluders))
+	{
+		MarkRenderStateDirty();
+	}
+
 	if(PropertyName == GET_MEMBER_NAME_CHECKED(UQuadtreeMeshComponent, TileSize))
 	{
 		SetTileSize(TileSize);
@@ -320,6 +350,13 @@ void UQuadtreeMeshComponent::PushTessellatedQuadtreeMeshBoundsToPoxy(const FBox2
 	}
 }
 
+void UQuadtreeMeshComponent::SetFocusRegion(const FBox2D& InFocusRegion)
+{
+	// Kept on the component as well so that a recreated proxy starts with it
+	FocusRegion = InFocusRegion;
+	PushTessellatedQuadtreeMeshBoundsToPoxy(FocusRegion);
+}
+
 
 void UQuadtreeMeshComponent::PostLoad()
 {
@@ -1,5 +1,7 @@
-﻿/*
-#include "QuadtreeMeshRender.h"
+﻿#include "QuadtreeMeshRender.h"
+#include "QuadtreeMeshSceneProxy.h"
+
+/*
 #include "LegacyScreenPercentageDriver.h"
 #include "Modules/ModuleManager.h"
 #include "RenderCaptureInterface.h"
@@ -222,6 +224,7 @@ public:
 			});#1#
 	}
 }
+*/
 
 FQuadtreeMeshViewExtension::FQuadtreeMeshViewExtension(const FAutoRegister& AutoReg, UWorld* InWorld)
 	:FWorldSceneViewExtension(AutoReg, InWorld)
@@ -238,7 +241,7 @@ void FQuadtreeMeshViewExtension::SetupView(FSceneViewFamily& InViewFamily, FScen
 {
 	
 	const TWeakObjectPtr<UWorld> WorldPtr = GetWorld();
-	check(WorldPtr.IsValid())
+	check(WorldPtr.IsValid());
 
 	static bool bUpdatingQuadtreeMeshInfo = false;
 	if (!bUpdatingQuadtreeMeshInfo)
@@ -260,8 +263,26 @@ void FQuadtreeMeshViewExtension::SetupViewFamily(FSceneViewFamily& InViewFamily)
 void FQuadtreeMeshViewExtension::PreRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder,
 	FSceneViewFamily& InViewFamily)
 {
-	
+	// The traversals run while the renderer sets up the frame and computes the visibility, GetDynamicMeshElements picks them up. GPU traversals are added to the graph here
+	for (FQuadtreeMeshSceneProxy* SceneProxy : SceneProxies)
+	{
+		if (&SceneProxy->GetScene() == InViewFamily.Scene)
+		{
+			SceneProxy->LaunchAsyncViewTraversals_RenderThread(GraphBuilder, InViewFamily);
+		}
+	}
+}
+
+void FQuadtreeMeshViewExtension::AddSceneProxy_RenderThread(FQuadtreeMeshSceneProxy* InSceneProxy)
+{
+	check(IsInRenderingThread());
+	SceneProxies.AddUnique(InSceneProxy);
+}
+
+void FQuadtreeMeshViewExtension::RemoveSceneProxy_RenderThread(FQuadtreeMeshSceneProxy* InSceneProxy)
+{
+	check(IsInRenderingThread());
+	SceneProxies.RemoveSwap(InSceneProxy);
 }
-*/
 
 
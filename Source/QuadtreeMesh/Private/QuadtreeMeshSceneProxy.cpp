@@ -1,10 +1,14 @@
 ﻿#include "QuadtreeMeshSceneProxy.h"
 #include "QuadtreeMeshComponent.h"
-#include "QuadtreeMeshViewExtension.h"
+#include "QuadtreeMeshRender.h"
 #include "RayTracingInstance.h"
 #include "RenderGraphBuilder.h"
 #include "Materials/Material.h"
 #include "Materials/MaterialRenderProxy.h"
+#include "Async/ParallelFor.h"
+#include "Algo/Compare.h"
+#include "DataDrivenShaderPlatformInfo.h"
+#include "ProfilingDebugging/CsvProfiler.h"
 
 
 DECLARE_STATS_GROUP(TEXT("Quadtree Mesh"), STATGROUP_QuadtreeMesh, STATCAT_Advanced);
@@ -12,6 +16,273 @@ DECLARE_DWORD_COUNTER_STAT(TEXT("Tiles Drawn"), STAT_QuadtreeMeshTilesDrawn, STA
 DECLARE_DWORD_COUNTER_STAT(TEXT("Draw Calls"), STAT_QuadtreeMeshDrawCalls, STATGROUP_QuadtreeMesh);
 DECLARE_DWORD_COUNTER_STAT(TEXT("Vertices Drawn"), STAT_QuadtreeMeshVerticesDrawn, STATGROUP_QuadtreeMesh);
 DECLARE_DWORD_COUNTER_STAT(TEXT("Number Drawn Materials"), STAT_QuadtreeMeshDrawnMats, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Traversed Views"), STAT_QuadtreeMeshTraversedViews, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Instance Pairs"), STAT_QuadtreeMeshInstancePairs, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Front To Back Instance Pairs"), STAT_QuadtreeMeshFrontToBackInstancePairs, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shared Traversal Views"), STAT_QuadtreeMeshSharedTraversalViews, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Traversal Reuse Hits"), STAT_QuadtreeMeshTraversalReuseHits, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Traversal Reuse Misses"), STAT_QuadtreeMeshTraversalReuseMisses, STATGROUP_QuadtreeMesh);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Adaptive LOD Bias"), STAT_QuadtreeMeshAdaptiveLODBias, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Adaptive Collapsed Density Levels"), STAT_QuadtreeMeshAdaptiveCollapsedDensityLevels, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Traversal Hits"), STAT_QuadtreeMeshAsyncTraversalHits, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Async Traversal Misses"), STAT_QuadtreeMeshAsyncTraversalMisses, STATGROUP_QuadtreeMesh);
+DECLARE_DWORD_COUNTER_STAT(TEXT("GPU Traversed Views"), STAT_QuadtreeMeshGPUTraversedViews, STATGROUP_QuadtreeMesh);
+DECLARE_CYCLE_STAT(TEXT("Traversal (All Views)"), STAT_QuadtreeMeshTraversal, STATGROUP_QuadtreeMesh);
+DECLARE_CYCLE_STAT(TEXT("Traversal Per View"), STAT_QuadtreeMeshTraversalPerView, STATGROUP_QuadtreeMesh);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshParallelViewTraversal(
+	TEXT("r.QuadtreeMesh.ParallelViewTraversal"),
+	1,
+	TEXT("Traverse the quadtree of each view as a separate parallel task in GetDynamicMeshElements (0: serial, 1: parallel when there is more than one view)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAsyncTraversal(
+	TEXT("r.QuadtreeMesh.AsyncTraversal"),
+	1,
+	TEXT("Launch the traversal of the views of a family the primitive is shown in as a task when the family starts rendering, so that it overlaps the work that precedes GetDynamicMeshElements (0: traverse in GetDynamicMeshElements)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshParallelTraversalSplitDepth(
+	TEXT("r.QuadtreeMesh.ParallelTraversal.SplitDepth"),
+	0,
+	TEXT("Number of quadtree levels below the root after which the subtrees of a single view are traversed as parallel tasks (0: serial traversal)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshSharedViewTraversal(
+	TEXT("r.QuadtreeMesh.SharedViewTraversal"),
+	1,
+	TEXT("Traverse the quadtree once for views that share their observer and LOD parameters, like the faces of a cube capture, and filter the tiles of each view against its own frustum"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshSharedViewTraversalMaxObserverDistance(
+	TEXT("r.QuadtreeMesh.SharedViewTraversal.MaxObserverDistance"),
+	20.0f,
+	TEXT("Views whose observers are closer than this in world units can share a traversal, which then selects the LODs of the first one"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshFootprintCulling(
+	TEXT("r.QuadtreeMesh.FootprintCulling"),
+	1,
+	TEXT("Cull flat tiles in 2D against the footprint of the view frustum on the Z slab of the quadtree instead of the 3D frustum planes"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshFootprintCullingMaxZRange(
+	TEXT("r.QuadtreeMesh.FootprintCulling.MaxZRange"),
+	100.0f,
+	TEXT("Quadtree nodes with a larger Z range in world units are culled against the 3D frustum planes even when footprint culling is enabled"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAnalyticCompleteRegions(
+	TEXT("r.QuadtreeMesh.AnalyticCompleteRegions"),
+	1,
+	TEXT("Select the tiles of complete quadtree regions directly from the LOD rings around the observer instead of walking their implicit children"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshHorizonCulling(
+	TEXT("r.QuadtreeMesh.HorizonCulling"),
+	1,
+	TEXT("Cull the tiles hidden behind the horizon occluders of the component during the traversal. Views using it don't reuse their traversal across frames"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshSortFrontToBack(
+	TEXT("r.QuadtreeMesh.SortFrontToBack"),
+	0,
+	TEXT("Sort the tiles of opaque materials by distance to the observer after the traversal. The traversal alone visits the nearest child first at every level, so tiles come out roughly front to back but a far tile of one quadrant can precede a near tile of the next"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshLODMetric(
+	TEXT("r.QuadtreeMesh.LODMetric"),
+	0,
+	TEXT("Metric used to select the LOD of the tiles of each view (0: world distance, 1: screen space error, the LOD distances of perspective views are scaled so that quads are about r.QuadtreeMesh.LODMetric.TargetPixels wide on screen)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshLODMetricTargetPixels(
+	TEXT("r.QuadtreeMesh.LODMetric.TargetPixels"),
+	8.0f,
+	TEXT("Projected quad edge length in pixels above which tiles are refined, when r.QuadtreeMesh.LODMetric is 1"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshBudgetMaxInstances(
+	TEXT("r.QuadtreeMesh.Budget.MaxInstances"),
+	0,
+	TEXT("Maximum number of tile instances per view. Tiles are refined in order of screen space error until the budget is reached, the rest stays at a coarser LOD (0: no limit)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshBudgetMaxVertices(
+	TEXT("r.QuadtreeMesh.Budget.MaxVertices"),
+	0,
+	TEXT("Maximum number of drawn vertices per view, see r.QuadtreeMesh.Budget.MaxInstances (0: no limit)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshTraversalReuse(
+	TEXT("r.QuadtreeMesh.TraversalReuse"),
+	1,
+	TEXT("Reuse the traversal of a previous frame for views with a view state as long as they stay within r.QuadtreeMesh.TraversalReuse.Margin of it (0: traverse every frame)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshTraversalReuseMargin(
+	TEXT("r.QuadtreeMesh.TraversalReuse.Margin"),
+	0.05f,
+	TEXT("How far the observer and the frustum can move before a view is traversed again, as a fraction of the LOD 0 distance. Reused traversals are culled with a frustum enlarged by this margin"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAdaptive(
+	TEXT("r.QuadtreeMesh.Adaptive"),
+	0,
+	TEXT("Adjust the LOD bias and the force collapse level every frame so that the measured cost of the previous frame meets r.QuadtreeMesh.Adaptive.TargetVertices and r.QuadtreeMesh.Adaptive.TargetTraversalMs"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAdaptiveTargetVertices(
+	TEXT("r.QuadtreeMesh.Adaptive.TargetVertices"),
+	2000000,
+	TEXT("Number of vertices drawn per frame over all views the adaptive LOD aims for (0: ignore the vertex count)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshAdaptiveTargetTraversalMs(
+	TEXT("r.QuadtreeMesh.Adaptive.TargetTraversalMs"),
+	0.0f,
+	TEXT("Traversal time per frame over all views in milliseconds the adaptive LOD aims for (0: ignore the traversal time)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshAdaptiveRate(
+	TEXT("r.QuadtreeMesh.Adaptive.Rate"),
+	0.1f,
+	TEXT("Fraction of the LOD bias correction estimated from the cost of a frame that is applied in the next one"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarQuadtreeMeshAdaptiveHysteresis(
+	TEXT("r.QuadtreeMesh.Adaptive.Hysteresis"),
+	0.1f,
+	TEXT("Dead band around the target in log2 of the cost ratio within which the adaptive LOD doesn't react. Also delays the rounding of the LOD bias by the same amount"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAdaptiveMinLODBias(
+	TEXT("r.QuadtreeMesh.Adaptive.MinLODBias"),
+	-4,
+	TEXT("Lowest LOD bias the adaptive LOD can apply. Never goes below the tightest LOD scale morphing supports"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAdaptiveMaxLODBias(
+	TEXT("r.QuadtreeMesh.Adaptive.MaxLODBias"),
+	0,
+	TEXT("Highest LOD bias the adaptive LOD can apply"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshAdaptiveForceCollapseFrames(
+	TEXT("r.QuadtreeMesh.Adaptive.ForceCollapseFrames"),
+	30,
+	TEXT("Consecutive frames over the target at the lowest LOD bias after which the adaptive LOD collapses one more density level, and under the target after which it restores one"),
+	ECVF_RenderThreadSafe);
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+static TAutoConsoleVariable<bool> CVarQuadtreeMeshParallelTraversalValidate(
+	TEXT("r.QuadtreeMesh.ParallelTraversal.Validate"),
+	false,
+	TEXT("Also run the serial traversal when the parallel one is used and ensure that both outputs are identical"),
+	ECVF_RenderThreadSafe);
+#endif
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshGPUTraversal(
+	TEXT("r.QuadtreeMesh.GPUTraversal"),
+	1,
+	TEXT("Traverse the views of quadtree meshes with Use GPU Traversal in compute shaders and draw their tiles with indirect draws. 0 traverses them on the CPU like the others"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshGPUTraversalMaxInstancesPerBucket(
+	TEXT("r.QuadtreeMesh.GPUTraversal.MaxInstancesPerBucket"),
+	16384,
+	TEXT("Instances a GPU traversal can write per material and density level, the tiles past it are not drawn"),
+	ECVF_RenderThreadSafe);
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+static TAutoConsoleVariable<bool> CVarQuadtreeMeshGPUTraversalValidate(
+	TEXT("r.QuadtreeMesh.GPUTraversal.Validate"),
+	false,
+	TEXT("Run the CPU emulation of each GPU traversal and the CPU traversal as well and ensure that they select the same instances"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<bool> CVarQuadtreeMeshGPUTraversalEmulate(
+	TEXT("r.QuadtreeMesh.GPUTraversal.Emulate"),
+	false,
+	TEXT("Traverse quadtree meshes with Use GPU Traversal with the CPU emulation of the kernels instead of dispatching them, so that their selection can be checked without compute shaders"),
+	ECVF_RenderThreadSafe);
+#endif
+
+static TAutoConsoleVariable<int32> CVarQuadtreeMeshShadows(
+	TEXT("r.QuadtreeMesh.Shadows"),
+	1,
+	TEXT("Let quadtree meshes with Cast Shadow enabled render into shadow depth views, with a traversal of their own that uses the Shadow view policy"),
+	ECVF_RenderThreadSafe);
+
+static EQuadtreeMeshViewType GetQuadtreeMeshViewType(const FSceneView& View)
+{
+	// Planar reflections are scene captures as well
+	if (View.bIsPlanarReflection)
+	{
+		return EQuadtreeMeshViewType::PlanarReflection;
+	}
+	if (View.bIsReflectionCapture)
+	{
+		return EQuadtreeMeshViewType::ReflectionCapture;
+	}
+	if (View.bIsSceneCapture)
+	{
+		return EQuadtreeMeshViewType::SceneCapture;
+	}
+	if (View.Family && View.Family->bThumbnailRendering)
+	{
+		return EQuadtreeMeshViewType::Thumbnail;
+	}
+	return EQuadtreeMeshViewType::Main;
+}
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+/** Instance pairs counted over all the views and proxies of a frame. The CSV stat is their ratio, it can only be computed once the frame is over */
+struct FFrontToBackInstancePairs
+{
+	FCriticalSection CriticalSection;
+	uint32 FrameNumber = 0;
+	int64 NumInstancePairs = 0;
+	int64 NumFrontToBackInstancePairs = 0;
+};
+static FFrontToBackInstancePairs GFrontToBackInstancePairs;
+
+/** Counting the front to back pairs walks every instance, only do it when the stat or the CSV can show the result */
+static bool ShouldCountFrontToBackInstancePairs()
+{
+	bool bShouldCount = false;
+#if STATS
+	bShouldCount |= FThreadStats::IsCollectingData();
+#endif
+#if CSV_PROFILER
+	bShouldCount |= FCsvProfiler::Get()->IsCapturing() && FCsvProfiler::Get()->IsCategoryEnabled(CSV_CATEGORY_INDEX_GLOBAL);
+#endif
+	return bShouldCount;
+}
+
+static void AddFrontToBackInstancePairs(int32 InNumInstancePairs, int32 InNumFrontToBackInstancePairs)
+{
+	INC_DWORD_STAT_BY(STAT_QuadtreeMeshInstancePairs, InNumInstancePairs);
+	INC_DWORD_STAT_BY(STAT_QuadtreeMeshFrontToBackInstancePairs, InNumFrontToBackInstancePairs);
+
+#if CSV_PROFILER
+	// The ratio of a frame is published by the first view of the next one, when no more pairs can be added to it
+	FScopeLock Lock(&GFrontToBackInstancePairs.CriticalSection);
+	if (GFrontToBackInstancePairs.FrameNumber != GFrameNumberRenderThread)
+	{
+		if (GFrontToBackInstancePairs.NumInstancePairs > 0)
+		{
+			CSV_CUSTOM_STAT_GLOBAL(QuadtreeMeshFrontToBackFraction, static_cast<float>(static_cast<double>(GFrontToBackInstancePairs.NumFrontToBackInstancePairs) / GFrontToBackInstancePairs.NumInstancePairs), ECsvCustomStatOp::Set);
+		}
+		GFrontToBackInstancePairs.FrameNumber = GFrameNumberRenderThread;
+		GFrontToBackInstancePairs.NumInstancePairs = 0;
+		GFrontToBackInstancePairs.NumFrontToBackInstancePairs = 0;
+	}
+	GFrontToBackInstancePairs.NumInstancePairs += InNumInstancePairs;
+	GFrontToBackInstancePairs.NumFrontToBackInstancePairs += InNumFrontToBackInstancePairs;
+#endif
+}
+#endif
 
 SIZE_T FQuadtreeMeshSceneProxy::GetTypeHash() const
 {
@@ -24,6 +295,8 @@ FQuadtreeMeshSceneProxy::FQuadtreeMeshSceneProxy(UQuadtreeMeshComponent* Compone
 	 MaterialRelevance(Component->GetQuadtreeMeshMaterialRelevance(GetScene().GetFeatureLevel())),
 	 bIsVisble(Component->IsVisible())
 {
+	// The per frame state is either atomic or locked and the instance data is allocated per call
+	bSupportsParallelGDME = true;
 	
 	// Cache the tiles and settings
 	MeshQuadTree = Component->GetMeshQuadTree();
@@ -36,12 +309,27 @@ FQuadtreeMeshSceneProxy::FQuadtreeMeshSceneProxy(UQuadtreeMeshComponent* Compone
 		ForceCollapseDensityLevel = Component->ForceCollapseDensityLevel;
 	}
 
+	for (const TPair<EQuadtreeMeshViewType, FQuadtreeMeshViewPolicy>& ViewPolicy : Component->ViewPolicies)
+	{
+		if (ViewPolicy.Key < EQuadtreeMeshViewType::Num)
+		{
+			ViewPolicies[static_cast<int32>(ViewPolicy.Key)] = ViewPolicy.Value;
+		}
+	}
+
+	HorizonOccluders = Component->HorizonOccluders;
+
+	TessellatedQuadtreeMeshBounds = Component->GetFocusRegion();
+
+	ViewExtension = Component->GetViewExtension();
+
 	int32 NumQuads = static_cast<int32>(FMath::Pow(2.0f, static_cast<float>(Component->GetTessellationFactor())));
+	NumQuadsPerTileSide = NumQuads;
 	DensityCount = FMath::Min(MeshQuadTree.GetTreeDepth(), static_cast<int32>(FMath::FloorLog2(NumQuads)));
 	QuadtreeMeshVertexFactories.Reserve(MeshQuadTree.GetTreeDepth());
 	for (uint8 i = 0; i < MeshQuadTree.GetTreeDepth(); i++)
 	{
-		QuadtreeMeshVertexFactories.Add(new FQuadtreeMeshVertexFactory(GetScene().GetFeatureLevel(), NumQuads,LODScale));
+		QuadtreeMeshVertexFactories.Add(new FQuadtreeMeshVertexFactory(GetScene().GetFeatureLevel(), NumQuads, LODScale, MeshQuadTree.GetLeafSize(), MeshQuadTree.GetOrigin(), TessellatedQuadtreeMeshBounds));
 		BeginInitResource(QuadtreeMeshVertexFactories.Last());
 
 		NumQuads /= 2;
@@ -55,11 +343,6 @@ FQuadtreeMeshSceneProxy::FQuadtreeMeshSceneProxy(UQuadtreeMeshComponent* Compone
 	QuadtreeMeshVertexFactories.Shrink();
 	check(DensityCount == QuadtreeMeshVertexFactories.Num());
 	
-	const int32 TotalLeafNodes = MeshQuadTree.GetMaxLeafCount();
-	QuadtreeMeshInstanceDataBuffers = new FQuadtreeMeshInstanceDataBuffers(TotalLeafNodes);
-
-	QuadtreeMeshUserDataBuffers = new FQuadtreeMeshUserDataBuffers(QuadtreeMeshInstanceDataBuffers);
-
 	MeshQuadTree.BuildMaterialIndices();
 	
 	
@@ -77,10 +360,6 @@ FQuadtreeMeshSceneProxy::~FQuadtreeMeshSceneProxy()
 		delete QuadtreeMeshFactory;
 	}
 
-	delete QuadtreeMeshInstanceDataBuffers;
-
-	delete QuadtreeMeshUserDataBuffers;
-
 #if RHI_RAYTRACING
 	for (auto& QuadtreeMeshDataArray : RayTracingQuadtreeMeshData)
 	{
@@ -97,29 +376,225 @@ void FQuadtreeMeshSceneProxy::CreateRenderThreadResources(FRHICommandListBase& R
 {
 	SceneProxyCreatedFrameNumberRenderThread = GFrameNumberRenderThread;
 
-	if (MeshQuadTree.IsGPUQuadTree())
+	if (ViewExtension.IsValid())
+	{
+		ViewExtension->AddSceneProxy_RenderThread(this);
+	}
+}
+
+void FQuadtreeMeshSceneProxy::DestroyRenderThreadResources()
+{
+	if (ViewExtension.IsValid())
+	{
+		ViewExtension->RemoveSceneProxy_RenderThread(this);
+	}
+
+	// The tasks still running reference this proxy
+	FScopeLock Lock(&AsyncViewTraversalsCriticalSection);
+	for (FAsyncViewTraversals& AsyncTraversal : AsyncViewTraversals)
+	{
+		AsyncTraversal.Task.Wait();
+	}
+	AsyncViewTraversals.Empty();
+
+	QuadTreeGPU.Release();
+}
+
+void FQuadtreeMeshSceneProxy::LaunchAsyncViewTraversals_RenderThread(FRDGBuilder& GraphBuilder, const FSceneViewFamily& InViewFamily)
+{
+	check(IsInRenderingThread());
+	FScopeLock Lock(&AsyncViewTraversalsCriticalSection);
+
+	// Drop the traversals of the previous frames that no GetDynamicMeshElements call consumed, the primitive wasn't visible in their views
+	for (int32 Index = AsyncViewTraversals.Num() - 1; Index >= 0; --Index)
+	{
+		if (AsyncViewTraversals[Index].Traversals->FrameNumber != InViewFamily.FrameNumber)
+		{
+			AsyncViewTraversals[Index].Task.Wait();
+			AsyncViewTraversals.RemoveAt(Index);
+		}
+	}
+
+	const bool bGPUTraversal = UseGPUTraversal();
+	const bool bAsyncTraversal = CVarQuadtreeMeshAsyncTraversal.GetValueOnRenderThread() != 0;
+	if ((!bGPUTraversal && !bAsyncTraversal) || !bIsVisble || !HasQuadtreeData() || InViewFamily.Views.Num() > 32
+		|| !InViewFamily.EngineShowFlags.Rendering || !ShouldRenderInMainPass())
+	{
+		return;
+	}
+
+	// Only the views the primitive can be drawn in: its hidden and show only lists, owner visibility and the editor and game show flags, like GetViewRelevance
+	uint32 TraversedViewMap = 0;
+	for (int32 ViewIndex = 0; ViewIndex < InViewFamily.Views.Num(); ++ViewIndex)
+	{
+		if (IsShown(InViewFamily.Views[ViewIndex]))
+		{
+			TraversedViewMap |= 1u << ViewIndex;
+		}
+	}
+	if (TraversedViewMap == 0)
+	{
+		return;
+	}
+
+	// The LOD parameters of the frame are read while setting up the traversals. A traversal left over from this frame already updated them and may still add its cost
+	if (AsyncViewTraversals.IsEmpty())
+	{
+		UpdateAdaptiveLOD(InViewFamily.FrameNumber);
+	}
+
+	// Frustum and occlusion culling of the primitive aren't known yet so every view it is shown in is traversed, GetDynamicMeshElements only keeps the visible ones
+	FAsyncViewTraversals& AsyncTraversal = AsyncViewTraversals.AddDefaulted_GetRef();
+	AsyncTraversal.ViewFamily = &InViewFamily;
+	AsyncTraversal.Views.Append(InViewFamily.Views);
+	AsyncTraversal.TraversedViewMap = TraversedViewMap;
+	SetupViewTraversals(InViewFamily.Views, InViewFamily, TraversedViewMap, nullptr, *AsyncTraversal.Traversals);
+
+	// GetDynamicMeshElements only adds the indirect draws of the views traversed on the GPU
+	if (bGPUTraversal && !AsyncTraversal.Traversals->bEmulateGPUTraversal && TraverseViewsOnGPU(GraphBuilder, *AsyncTraversal.Traversals))
+	{
+		return;
+	}
+	if (!bAsyncTraversal)
+	{
+		AsyncViewTraversals.Pop();
+		return;
+	}
+
+	// The traversals of the families of a frame share the traversal cache and the adaptive LOD measurements, they run one after the other
+	TSharedRef<FViewTraversals> Traversals = AsyncTraversal.Traversals;
+	if (AsyncViewTraversals.Num() > 1 && AsyncViewTraversals[AsyncViewTraversals.Num() - 2].Task.IsValid())
+	{
+		AsyncTraversal.Task = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, Traversals]() { TraverseViews(*Traversals); }, UE::Tasks::Prerequisites(AsyncViewTraversals[AsyncViewTraversals.Num() - 2].Task));
+	}
+	else
+	{
+		AsyncTraversal.Task = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, Traversals]() { TraverseViews(*Traversals); });
+	}
+}
+
+bool FQuadtreeMeshSceneProxy::UseGPUTraversal() const
+{
+	return MeshQuadTree.IsGPUQuadTree()
+		&& (CVarQuadtreeMeshGPUTraversal.GetValueOnRenderThread() != 0)
+		&& IsFeatureLevelSupported(GetScene().GetShaderPlatform(), ERHIFeatureLevel::SM5);
+}
+
+bool FQuadtreeMeshSceneProxy::TraverseViewsOnGPU(FRDGBuilder& GraphBuilder, FViewTraversals& InOut)
+{
+	// Instanced stereo draws every instance once per eye, from copies the kernels don't write
+	if (InOut.bEncounteredISRView)
+	{
+		return false;
+	}
+
+	TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<4>> GPUTraversalDescs = InOut.TraversalDescPerView;
+	for (FMeshQuadTree::FTraversalDesc& TraversalDesc : GPUTraversalDescs)
+	{
+		if (!FMeshQuadTreeGPU::MakeGPUTraversalDesc(TraversalDesc))
+		{
+			return false;
+		}
+	}
+
+	TArray<uint32> BucketIndexCounts;
+	for (int32 MaterialIndex = 0; MaterialIndex < MeshQuadTree.GetQuadtreeMeshMaterials().Num(); ++MaterialIndex)
+	{
+		for (int32 DensityIndex = 0; DensityIndex < DensityCount; ++DensityIndex)
+		{
+			BucketIndexCounts.Add(QuadtreeMeshVertexFactories[DensityIndex]->IndexBuffer->GetIndexCount());
+		}
+	}
+
+	InOut.TraversalDescPerView = MoveTemp(GPUTraversalDescs);
+	InOut.QuadtreeMeshInstanceDataPerView.SetNum(InOut.TraversalDescPerView.Num());
+	for (const FMeshQuadTree::FTraversalDesc& TraversalDesc : InOut.TraversalDescPerView)
+	{
+		FMeshQuadTreeGPU::FTraverseParams TraverseParams;
+		FMeshQuadTreeGPU::BuildTraverseParams(MeshQuadTree, TraversalDesc, InOut.GPUTraversalBucketCapacity, TraverseParams);
+		InOut.GPUTraversalResultPerView.Add(QuadTreeGPU.Traverse(GraphBuilder, MeshQuadTree, TraverseParams, BucketIndexCounts, InOut.FrameNumber));
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+		if (CVarQuadtreeMeshGPUTraversalValidate.GetValueOnRenderThread())
+		{
+			FMeshQuadTreeGPU::ValidateEmulation(MeshQuadTree, TraversalDesc, InOut.GPUTraversalBucketCapacity);
+		}
+#endif
+	}
+
+	INC_DWORD_STAT_BY(STAT_QuadtreeMeshGPUTraversedViews, InOut.TraversalDescPerView.Num());
+	return true;
+}
+
+bool FQuadtreeMeshSceneProxy::ConsumeAsyncViewTraversals(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FViewTraversals& Out) const
+{
+	FScopeLock Lock(&AsyncViewTraversalsCriticalSection);
+	if (AsyncViewTraversals.IsEmpty())
+	{
+		return false;
+	}
+
+	// The traversals of the other families may still update the traversal cache, which the synchronous path uses too
+	for (FAsyncViewTraversals& AsyncTraversal : AsyncViewTraversals)
+	{
+		AsyncTraversal.Task.Wait();
+	}
+
+	// A view the launch skipped can't be visible, unless the primitive became shown in between
+	const int32 AsyncTraversalIndex = AsyncViewTraversals.IndexOfByPredicate([&Views, &ViewFamily, VisibilityMap](const FAsyncViewTraversals& AsyncTraversal)
+	{
+		return (AsyncTraversal.ViewFamily == &ViewFamily)
+			&& (AsyncTraversal.Traversals->FrameNumber == ViewFamily.FrameNumber)
+			&& Algo::Compare(AsyncTraversal.Views, Views)
+			&& (VisibilityMap & ~AsyncTraversal.TraversedViewMap) == 0;
+	});
+	if (AsyncTraversalIndex == INDEX_NONE)
+	{
+		INC_DWORD_STAT(STAT_QuadtreeMeshAsyncTraversalMisses);
+		return false;
+	}
+	INC_DWORD_STAT(STAT_QuadtreeMeshAsyncTraversalHits);
+
+	FViewTraversals& Traversals = *AsyncViewTraversals[AsyncTraversalIndex].Traversals;
+	Out.FrameNumber = Traversals.FrameNumber;
+	Out.bEncounteredISRView = Traversals.bEncounteredISRView;
+	Out.InstanceFactor = Traversals.InstanceFactor;
+
+	// Keep the views the primitive turned out to be visible in
+	for (int32 TraversalIndex = 0; TraversalIndex < Traversals.TraversalDescPerView.Num(); ++TraversalIndex)
 	{
-		FQuadtreeMeshGPUWork::FCallback Callback;
-		Callback.Proxy = this;
-		Callback.Function = [this](FRDGBuilder& GraphBuilder, bool bDepthBufferIsPopulated)
+		const int32 ViewIndex = Traversals.ViewIndexPerTraversal[TraversalIndex];
+		if (VisibilityMap & (1 << ViewIndex))
 		{
-			/*if (bNeedToTraverseGPUQuadTree)
+			Out.TraversalDescPerView.Add(MoveTemp(Traversals.TraversalDescPerView[TraversalIndex]));
+			Out.QuadtreeMeshInstanceDataPerView.Add(MoveTemp(Traversals.QuadtreeMeshInstanceDataPerView[TraversalIndex]));
+			Out.ViewIndexPerTraversal.Add(ViewIndex);
+			Out.ViewKeyPerTraversal.Add(Traversals.ViewKeyPerTraversal[TraversalIndex]);
+			Out.RefreshIntervalPerTraversal.Add(Traversals.RefreshIntervalPerTraversal[TraversalIndex]);
+			if (Traversals.GPUTraversalResultPerView.Num() > 0)
 			{
-				if (!QuadTreeGPU.IsInitialized())
-				{
-					BuildGPUQuadTree(GraphBuilder);
-				}
-				FWaterQuadTreeGPU::FTraverseParams TraverseParams = MoveTemp(WaterQuadTreeGPUTraverseParams);
-				TraverseParams.bDepthBufferIsPopulated = bDepthBufferIsPopulated;
-				QuadTreeGPU.Traverse(GraphBuilder, TraverseParams);
-				bNeedToTraverseGPUQuadTree = false;
-				WaterQuadTreeGPUTraverseParams = {};
-			}*/
-		};
-		//GWaterMeshGPUWork.Callbacks.Add(MoveTemp(Callback));
+				Out.GPUTraversalResultPerView.Add(Traversals.GPUTraversalResultPerView[TraversalIndex]);
+			}
+		}
 	}
+
+	AsyncViewTraversals.RemoveAt(AsyncTraversalIndex);
+	return true;
 }
 
+/** Instance and user data of one GetDynamicMeshElements call, released with the other one frame resources of its collector */
+class FQuadtreeMeshOneFrameBuffers : public FOneFrameResource
+{
+public:
+	FQuadtreeMeshOneFrameBuffers()
+		: UserDataBuffers(&InstanceDataBuffers)
+	{
+	}
+
+	FQuadtreeMeshInstanceDataBuffers InstanceDataBuffers;
+	FQuadtreeMeshUserDataBuffers UserDataBuffers;
+};
+
 void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneView*>& Views,
                                                      const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const
 {
@@ -131,8 +606,6 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 		return;
 	}
 	
-	FRHICommandListBase& RHICmdList = Collector.GetRHICommandList();
-
 	// The water render groups we have to render for this batch : 
 	TArray<EQuadtreeMeshRenderGroupType, TInlineAllocator<FQuadtreeMeshVertexFactory::NumRenderGroups>> BatchRenderGroups;
 	// By default, render all water tiles : 
@@ -154,6 +627,15 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 		return;
 	}
 
+	// Shadow depth views are gathered on their own, with the light frustum set for the duration of the call
+	const bool bShadowTraversal = (ShadowCullFrustum != nullptr);
+
+	// The traversal launched ahead by the view extension has to be done before this call reads or traverses anything
+	FViewTraversals Traversals;
+	const bool bAsyncTraversal = !bShadowTraversal && ConsumeAsyncViewTraversals(Views, ViewFamily, VisibilityMap, Traversals);
+
+	UpdateAdaptiveLOD(ViewFamily.FrameNumber);
+
 	// Set up wireframe material (if needed)
 	const bool bWireframe = AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
 
@@ -169,57 +651,19 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 
 	const int32 NumBuckets = MeshQuadTree.GetQuadtreeMeshMaterials().Num() * DensityCount;
 
-	TArray<FMeshQuadTree::FTraversalOutput, TInlineAllocator<4>> QuadtreeMeshInstanceDataPerView;
-
-	bool bEncounteredISRView = false;
-	int32 InstanceFactor = 1;
-
-	// Gather visible tiles, their lod and materials for all renderable views (skip right view when stereo pair is rendered instanced)
-	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
+	if (!bAsyncTraversal)
 	{
-		const FSceneView* View = Views[ViewIndex];
-		if (!bEncounteredISRView && View->IsInstancedStereoPass())
-		{
-			bEncounteredISRView = true;
-			InstanceFactor = View->GetStereoPassInstanceFactor();
-		}
-
-		// skip gathering visible tiles from instanced right eye views
-		if ((VisibilityMap & (1 << ViewIndex)) && (!bEncounteredISRView || View->IsPrimarySceneView()))
-		{
-			const FVector ObserverPosition = View->ViewMatrices.GetViewOrigin();
-			
-			FQuadtreeMeshLODParams QuadtreeMeshLODParams = GetQuadtreeMeshLODParams(ObserverPosition);
-
-	TRACE_CPUPROFILER_EVENT_SCOPE(QuadTreeTraversalPerView);
-
-			FMeshQuadTree::FTraversalOutput& QuadtreeMeshInstanceData = QuadtreeMeshInstanceDataPerView.Emplace_GetRef();
-			QuadtreeMeshInstanceData.BucketInstanceCounts.Empty(NumBuckets);
-			QuadtreeMeshInstanceData.BucketInstanceCounts.AddZeroed(NumBuckets);
-			
-
-			FMeshQuadTree::FTraversalDesc TraversalDesc;
-			TraversalDesc.LowestLOD = QuadtreeMeshLODParams.LowestLOD;
-			TraversalDesc.HeightMorph = QuadtreeMeshLODParams.HeightLODFactor;
-			TraversalDesc.LODCount = MeshQuadTree.GetTreeDepth();
-			TraversalDesc.DensityCount = DensityCount;
-			TraversalDesc.ForceCollapseDensityLevel = ForceCollapseDensityLevel;
-			TraversalDesc.Frustum = View->ViewFrustum;
-			TraversalDesc.ObserverPosition = ObserverPosition;
-			TraversalDesc.PreViewTranslation = View->ViewMatrices.GetPreViewTranslation();
-			TraversalDesc.LODScale = LODScale;
-			TraversalDesc.bLODMorphingEnabled = true;
-			TraversalDesc.TessellatedQuadtreeMeshBounds = TessellatedQuadtreeMeshBounds;
-
-#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
-			TraversalDesc.DebugPDI = Collector.GetPDI(ViewIndex);
-#endif
-			MeshQuadTree.BuildQuadtreeMeshTileInstanceData(TraversalDesc, QuadtreeMeshInstanceData);
-			
-			HistoricalMaxViewInstanceCount = FMath::Max(HistoricalMaxViewInstanceCount, QuadtreeMeshInstanceData.InstanceCount);
-		}
+		SetupViewTraversals(Views, ViewFamily, VisibilityMap, &Collector, Traversals);
+		TraverseViews(Traversals);
 	}
 
+	const TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<4>>& TraversalDescPerView = Traversals.TraversalDescPerView;
+	TArray<FMeshQuadTree::FTraversalOutput, TInlineAllocator<4>>& QuadtreeMeshInstanceDataPerView = Traversals.QuadtreeMeshInstanceDataPerView;
+	const bool bEncounteredISRView = Traversals.bEncounteredISRView;
+	const int32 InstanceFactor = Traversals.InstanceFactor;
+	// The views traversed on the GPU are drawn with indirect draws from the buffers of their traversal, their instance counts are never known here
+	const bool bGPUTraversal = Traversals.GPUTraversalResultPerView.Num() > 0;
+
 	// Get number of total instances for all views
 	int32 TotalInstanceCount = 0;
 	for (const FMeshQuadTree::FTraversalOutput& QuadtreeMeshInstanceData : QuadtreeMeshInstanceDataPerView)
@@ -227,13 +671,20 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 		TotalInstanceCount += QuadtreeMeshInstanceData.InstanceCount;
 	}
 
-	if (TotalInstanceCount == 0)
+	if (TotalInstanceCount == 0 && !bGPUTraversal)
 	{
 		// no instance visible, early exit
 		return;
 	}
 
-	QuadtreeMeshInstanceDataBuffers->Lock(RHICmdList, TotalInstanceCount * InstanceFactor);
+	// The instance data of this call is suballocated from the dynamic vertex buffer of the collector. Concurrent calls for other views or proxies write their own allocation
+	FQuadtreeMeshOneFrameBuffers* OneFrameBuffers = nullptr;
+	if (!bGPUTraversal)
+	{
+		OneFrameBuffers = &Collector.AllocateOneFrameResource<FQuadtreeMeshOneFrameBuffers>();
+		OneFrameBuffers->InstanceDataBuffers.Allocate(Collector.GetDynamicVertexBuffer(), TotalInstanceCount * InstanceFactor);
+	}
+	static_assert(FMeshQuadTree::NumStreams == FQuadtreeMeshInstanceDataBuffers::NumBuffers, "The GPU traversal writes one buffer per instance data stream");
 
 	int32 InstanceDataOffset = 0;
 
@@ -247,9 +698,24 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 			TRACE_CPUPROFILER_EVENT_SCOPE(BucketsPerView);
 
 			FMeshQuadTree::FTraversalOutput& QuadtreeMeshInstanceData = QuadtreeMeshInstanceDataPerView[TraversalIndex];
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+			const FMeshQuadTree::FTraversalDesc& TraversalDesc = TraversalDescPerView[TraversalIndex];
+#endif
 			const int32 NumQuadtreeMeshMaterials = MeshQuadTree.GetQuadtreeMeshMaterials().Num();
+			const FMeshQuadTreeGPU::FTraversalResult* GPUTraversalResult = bGPUTraversal ? &Traversals.GPUTraversalResultPerView[TraversalIndex] : nullptr;
 			TraversalIndex++;
 
+			if (GPUTraversalResult)
+			{
+				if (!GPUTraversalResult->IsValid())
+				{
+					continue;
+				}
+				// Each view reads the buffers of its own traversal
+				OneFrameBuffers = &Collector.AllocateOneFrameResource<FQuadtreeMeshOneFrameBuffers>();
+				OneFrameBuffers->InstanceDataBuffers.SetExternalBuffers(GPUTraversalResult->InstanceBuffers);
+			}
+
 			for (int32 MaterialIndex = 0; MaterialIndex < NumQuadtreeMeshMaterials; ++MaterialIndex)
 			{
 				TRACE_CPUPROFILER_EVENT_SCOPE(MaterialBucket);
@@ -258,9 +724,9 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 				for (int32 DensityIndex = 0; DensityIndex < DensityCount; ++DensityIndex)
 				{
 					const int32 BucketIndex = MaterialIndex * DensityCount + DensityIndex;
-					const int32 InstanceCount = QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex];
+					const int32 InstanceCount = GPUTraversalResult ? 0 : QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex];
 
-					if (!InstanceCount)
+					if (!InstanceCount && !GPUTraversalResult)
 					{
 						continue;
 					}
@@ -292,7 +758,7 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 						Mesh.DepthPriorityGroup = SDPG_World;
 						//Mesh.bCanApplyViewModeOverrides = true;
 						Mesh.bUseForMaterial = true;
-						Mesh.CastShadow = false;
+						Mesh.CastShadow = bShadowTraversal;
 						// Preemptively turn off depth rendering for this mesh batch if the material doesn't need it
 						Mesh.bUseForDepthPass = bUseForDepthPass;
 						Mesh.bUseAsOccluder = false;
@@ -313,11 +779,20 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 							// Set up for instancing
 							//BatchElement.bIsInstancedMesh = true;
 							BatchElement.NumInstances = InstanceCount;
-							BatchElement.UserData = (void*)QuadtreeMeshUserDataBuffers->GetUserData(RenderGroup);
+							BatchElement.UserData = (void*)OneFrameBuffers->UserDataBuffers.GetUserData(RenderGroup);
 							BatchElement.UserIndex = InstanceDataOffset * InstanceFactor;
 
 							BatchElement.FirstIndex = 0;
 							BatchElement.NumPrimitives = QuadtreeMeshVertexFactories[DensityIndex]->IndexBuffer->GetIndexCount() / 3;
+							if (GPUTraversalResult)
+							{
+								// The instance count comes from the arguments written by the traversal, the instances of the bucket start at its region of the buffers
+								BatchElement.NumInstances = 1;
+								BatchElement.UserIndex = BucketIndex * GPUTraversalResult->BucketCapacity;
+								BatchElement.NumPrimitives = 0;
+								BatchElement.IndirectArgsBuffer = GPUTraversalResult->IndirectArgsBuffer;
+								BatchElement.IndirectArgsOffset = BucketIndex * sizeof(FRHIDrawIndexedIndirectParameters);
+							}
 							BatchElement.MinVertexIndex = 0;
 							BatchElement.MaxVertexIndex = QuadtreeMeshVertexFactories[DensityIndex]->VertexBuffer->GetVertexCount() - 1;
 
@@ -330,9 +805,15 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 						}
 
 						{
-							INC_DWORD_STAT_BY(STAT_QuadtreeMeshVerticesDrawn, QuadtreeMeshVertexFactories[DensityIndex]->VertexBuffer->GetVertexCount() * InstanceCount);
+							if (!GPUTraversalResult)
+							{
+								const int64 VertexCount = static_cast<int64>(QuadtreeMeshVertexFactories[DensityIndex]->VertexBuffer->GetVertexCount()) * InstanceCount;
+								AdaptiveLOD.VertexCount.fetch_add(VertexCount, std::memory_order_relaxed);
+
+								INC_DWORD_STAT_BY(STAT_QuadtreeMeshVerticesDrawn, VertexCount);
+								INC_DWORD_STAT_BY(STAT_QuadtreeMeshTilesDrawn, InstanceCount);
+							}
 							INC_DWORD_STAT(STAT_QuadtreeMeshDrawCalls);
-							INC_DWORD_STAT_BY(STAT_QuadtreeMeshTilesDrawn, InstanceCount);
 
 							TRACE_CPUPROFILER_EVENT_SCOPE(Collector.AddMesh);
 
@@ -342,41 +823,638 @@ void FQuadtreeMeshSceneProxy::GetDynamicMeshElements(const TArray<const FSceneVi
 
 					// Note : we're repurposing the BucketInstanceCounts array here for storing the actual offset in the buffer. This means that effectively from this point on, BucketInstanceCounts doesn't actually 
 					//  contain the number of instances anymore : 
-					QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex] = InstanceDataOffset;
-					InstanceDataOffset += InstanceCount;
+					if (!GPUTraversalResult)
+					{
+						QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex] = InstanceDataOffset;
+						InstanceDataOffset += InstanceCount;
+					}
 				}
 
 				INC_DWORD_STAT_BY(STAT_QuadtreeMeshDrawnMats, static_cast<int32>(bMaterialDrawn));
 			}
 
-			const int32 NumStagingInstances = QuadtreeMeshInstanceData.StagingInstanceData.Num();
-			for (int32 Idx = 0; Idx < NumStagingInstances; ++Idx)
+			if (GPUTraversalResult)
+			{
+				continue;
+			}
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+			// Count the consecutive instances of each bucket that are front to back, to measure how well early Z can reject them
+			if (ShouldCountFrontToBackInstancePairs())
+			{
+				const FVector2f TileObserverPosition = FVector2f((FVector2D(TraversalDesc.ObserverPosition) - FVector2D(MeshQuadTree.GetOrigin())) / MeshQuadTree.GetLeafSize());
+				int32 NumInstancePairs = 0;
+				int32 NumFrontToBackInstancePairs = 0;
+				for (const FMeshQuadTree::FBucketInstanceData& Bucket : QuadtreeMeshInstanceData.BucketInstanceData)
+				{
+					float LastSquaredDistance = -1.0f;
+					for (int32 Idx = 0; Idx < Bucket.Streams[0].Num(); ++Idx)
+					{
+						const float SquaredDistance = FMeshQuadTree::GetInstanceTileBounds(Bucket.Streams[0][Idx]).ComputeSquaredDistanceToPoint(TileObserverPosition);
+						if (LastSquaredDistance >= 0.0f)
+						{
+							++NumInstancePairs;
+							NumFrontToBackInstancePairs += (SquaredDistance >= LastSquaredDistance) ? 1 : 0;
+						}
+						LastSquaredDistance = SquaredDistance;
+					}
+				}
+				AddFrontToBackInstancePairs(NumInstancePairs, NumFrontToBackInstancePairs);
+			}
+#endif
+
+			// Each stream of a bucket is already contiguous, it lands at the offset of the bucket in one copy
+			for (int32 BucketIndex = 0; BucketIndex < NumBuckets; ++BucketIndex)
 			{
-				const FMeshQuadTree::FStagingInstanceData& Data = QuadtreeMeshInstanceData.StagingInstanceData[Idx];
-				const int32 WriteIndex = QuadtreeMeshInstanceData.BucketInstanceCounts[Data.BucketIndex]++;
+				const FMeshQuadTree::FBucketInstanceData& Bucket = QuadtreeMeshInstanceData.BucketInstanceData[BucketIndex];
+				const int32 NumBucketInstances = Bucket.Streams[0].Num();
+				if (NumBucketInstances == 0)
+				{
+					continue;
+				}
 
+				const int32 WriteIndex = QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex];
 				for (int32 StreamIdx = 0; StreamIdx < FQuadtreeMeshInstanceDataBuffers::NumBuffers; ++StreamIdx)
 				{
-					TArrayView<FVector4f> BufferMemory = QuadtreeMeshInstanceDataBuffers->GetBufferMemory(StreamIdx);
-					for (int32 IdxMultipliedInstance = 0; IdxMultipliedInstance < InstanceFactor; ++IdxMultipliedInstance)
+					TArrayView<FVector4f> BufferMemory = OneFrameBuffers->InstanceDataBuffers.GetBufferMemory(StreamIdx);
+					const TArray<FVector4f>& Stream = Bucket.Streams[StreamIdx];
+					if (InstanceFactor == 1)
 					{
-						BufferMemory[WriteIndex * InstanceFactor + IdxMultipliedInstance] = Data.Data[StreamIdx];
+						FMemory::Memcpy(BufferMemory.GetData() + WriteIndex, Stream.GetData(), NumBucketInstances * sizeof(FVector4f));
+						continue;
+					}
+
+					for (int32 Idx = 0; Idx < NumBucketInstances; ++Idx)
+					{
+						for (int32 IdxMultipliedInstance = 0; IdxMultipliedInstance < InstanceFactor; ++IdxMultipliedInstance)
+						{
+							BufferMemory[(WriteIndex + Idx) * InstanceFactor + IdxMultipliedInstance] = Stream[Idx];
+						}
 					}
 				}
 			}
 		}
 	}
+}
 
-	QuadtreeMeshInstanceDataBuffers->Unlock(RHICmdList);
+void FQuadtreeMeshSceneProxy::SetupViewTraversals(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector* Collector, FViewTraversals& Out) const
+{
+	Out.FrameNumber = ViewFamily.FrameNumber;
+	Out.TraversalReuseMargin = (CVarQuadtreeMeshTraversalReuse.GetValueOnRenderThread() != 0)
+		? FMath::Max(CVarQuadtreeMeshTraversalReuseMargin.GetValueOnRenderThread(), 0.0f) * FMeshQuadTree::GetLODDistance(0, LODScale)
+		: 0.0;
+	Out.SharedTraversalMaxObserverDistance = (CVarQuadtreeMeshSharedViewTraversal.GetValueOnRenderThread() != 0)
+		? FMath::Max(CVarQuadtreeMeshSharedViewTraversalMaxObserverDistance.GetValueOnRenderThread(), 0.0f)
+		: -1.0;
+	Out.bParallelViewTraversal = CVarQuadtreeMeshParallelViewTraversal.GetValueOnRenderThread() != 0;
+	Out.GPUTraversalBucketCapacity = FMath::Max(CVarQuadtreeMeshGPUTraversalMaxInstancesPerBucket.GetValueOnRenderThread(), 1);
+
+	// Gather the traversal parameters for all renderable views (skip right view when stereo pair is rendered instanced)
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
+	{
+		const FSceneView* View = Views[ViewIndex];
+		if (!Out.bEncounteredISRView && View->IsInstancedStereoPass())
+		{
+			Out.bEncounteredISRView = true;
+			Out.InstanceFactor = View->GetStereoPassInstanceFactor();
+		}
+
+		// skip gathering visible tiles from instanced right eye views
+		if ((VisibilityMap & (1 << ViewIndex)) && (!Out.bEncounteredISRView || View->IsPrimarySceneView()))
+		{
+			// Shadow depth views select the tiles around the camera they are rendered for rather than around the light
+			const FVector ObserverPosition = ShadowCullFrustum ? View->ShadowViewMatrices.GetViewOrigin() : View->ViewMatrices.GetViewOrigin();
+			const FQuadtreeMeshViewPolicy& ViewPolicy = ViewPolicies[static_cast<int32>(ShadowCullFrustum ? EQuadtreeMeshViewType::Shadow : GetQuadtreeMeshViewType(*View))];
+
+			// The screen space error metric scales the LOD distances with the resolution and field of view of the view
+			int32 LODBias = 0;
+			if (CVarQuadtreeMeshLODMetric.GetValueOnRenderThread() == 1 && View->ViewMatrices.IsPerspectiveProjection() && !ShadowCullFrustum)
+			{
+				const double ProjectionScale = 0.5 * View->ViewRect.Width() * View->ViewMatrices.GetProjectionMatrix().M[0][0];
+				LODBias = FMeshQuadTree::GetScreenSpaceErrorLODBias(LODScale, MeshQuadTree.GetLeafSize(), NumQuadsPerTileSide, ProjectionScale, CVarQuadtreeMeshLODMetricTargetPixels.GetValueOnRenderThread());
+			}
+			LODBias = FMath::Max(LODBias + ViewPolicy.LODBias + AdaptiveLOD.AppliedLODBias, FMeshQuadTree::GetMinLODBias(LODScale, MeshQuadTree.GetLeafSize()));
+			const float ViewLODScale = LODScale * FMath::Pow(2.0f, static_cast<float>(LODBias));
+			
+			FQuadtreeMeshLODParams QuadtreeMeshLODParams = GetQuadtreeMeshLODParams(ObserverPosition, ViewLODScale);
+
+			FMeshQuadTree::FTraversalDesc& TraversalDesc = Out.TraversalDescPerView.AddDefaulted_GetRef();
+			TraversalDesc.LowestLOD = QuadtreeMeshLODParams.LowestLOD;
+			TraversalDesc.HeightMorph = QuadtreeMeshLODParams.HeightLODFactor;
+			TraversalDesc.LODCount = MeshQuadTree.GetTreeDepth();
+			TraversalDesc.DensityCount = DensityCount;
+			TraversalDesc.ForceCollapseDensityLevel = FMath::Min(ForceCollapseDensityLevel, AdaptiveLOD.ForceCollapseDensityLevel);
+			TraversalDesc.MinDensityLevel = FMath::Clamp(ViewPolicy.MinDensityLevel, 0, DensityCount - 1);
+			TraversalDesc.Frustum = ShadowCullFrustum ? *ShadowCullFrustum : View->ViewFrustum;
+			if (ViewPolicy.BoundsExtent > 0.0f)
+			{
+				// Restrict the view to a box around the observer by culling against its sides as well
+				TraversalDesc.Frustum.Planes.Add(FPlane(1.0, 0.0, 0.0, ObserverPosition.X + ViewPolicy.BoundsExtent));
+				TraversalDesc.Frustum.Planes.Add(FPlane(-1.0, 0.0, 0.0, -(ObserverPosition.X - ViewPolicy.BoundsExtent)));
+				TraversalDesc.Frustum.Planes.Add(FPlane(0.0, 1.0, 0.0, ObserverPosition.Y + ViewPolicy.BoundsExtent));
+				TraversalDesc.Frustum.Planes.Add(FPlane(0.0, -1.0, 0.0, -(ObserverPosition.Y - ViewPolicy.BoundsExtent)));
+				TraversalDesc.Frustum.Init();
+			}
+			TraversalDesc.ObserverPosition = ObserverPosition;
+			TraversalDesc.LODScale = LODScale;
+			TraversalDesc.LODBias = LODBias;
+			// The depth of a coarse shadow doesn't pop noticeably, the morph isn't worth its vertex work there
+			TraversalDesc.bLODMorphingEnabled = !ShadowCullFrustum;
+			TraversalDesc.TessellatedQuadtreeMeshBounds = TessellatedQuadtreeMeshBounds;
+			TraversalDesc.ParallelSplitDepth = FMath::Max(CVarQuadtreeMeshParallelTraversalSplitDepth.GetValueOnRenderThread(), 0);
+			TraversalDesc.bFootprintCulling = CVarQuadtreeMeshFootprintCulling.GetValueOnRenderThread() != 0;
+			TraversalDesc.FootprintMaxZRange = FMath::Max(CVarQuadtreeMeshFootprintCullingMaxZRange.GetValueOnRenderThread(), 0.0f);
+			TraversalDesc.bAnalyticCompleteRegions = CVarQuadtreeMeshAnalyticCompleteRegions.GetValueOnRenderThread() != 0;
+			// The light sees past the horizon of the observer
+			if (CVarQuadtreeMeshHorizonCulling.GetValueOnRenderThread() != 0 && !ShadowCullFrustum)
+			{
+				TraversalDesc.HorizonOccluders = HorizonOccluders;
+			}
+			// Translucent tiles are not sorted by the depth test, their order doesn't matter
+			TraversalDesc.bSortFrontToBack = (CVarQuadtreeMeshSortFrontToBack.GetValueOnRenderThread() != 0) && MaterialRelevance.bOpaque;
+			TraversalDesc.InstanceBudget = FMath::Max(CVarQuadtreeMeshBudgetMaxInstances.GetValueOnRenderThread(), 0);
+			TraversalDesc.VertexBudget = FMath::Max(CVarQuadtreeMeshBudgetMaxVertices.GetValueOnRenderThread(), 0);
+			if (TraversalDesc.VertexBudget > 0)
+			{
+				for (const FQuadtreeMeshVertexFactory* VertexFactory : QuadtreeMeshVertexFactories)
+				{
+					TraversalDesc.DensityVertexCounts.Add(VertexFactory->VertexBuffer->GetVertexCount());
+				}
+			}
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+			TraversalDesc.DebugPDI = Collector ? Collector->GetPDI(ViewIndex) : nullptr;
+			TraversalDesc.bValidateParallelTraversal = CVarQuadtreeMeshParallelTraversalValidate.GetValueOnRenderThread();
+#endif
+
+			const uint32 RefreshInterval = static_cast<uint32>(FMath::Max(ViewPolicy.RefreshInterval, 0));
+			// Shadow depth views share the view state of their main view, whose cached traversal they must not replace
+			bool bCanReuseTraversal = (View->State != nullptr) && !ShadowCullFrustum && (Out.TraversalReuseMargin > 0.0 || RefreshInterval > 0);
+			// What the occluders hide changes with any movement of the observer
+			bCanReuseTraversal &= TraversalDesc.HorizonOccluders.IsEmpty() || (RefreshInterval > 0);
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+			// Debug drawing happens during the traversal
+			bCanReuseTraversal &= (TraversalDesc.DebugShowTile == 0);
+#endif
+			Out.ViewKeyPerTraversal.Add(bCanReuseTraversal ? View->State->GetViewKey() : 0);
+			Out.RefreshIntervalPerTraversal.Add(RefreshInterval);
+			Out.ViewIndexPerTraversal.Add(ViewIndex);
+		}
+	}
+
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+	// The emulation selects what the kernels would, so neither the cache nor the shared traversals apply to it
+	if (MeshQuadTree.IsGPUQuadTree() && CVarQuadtreeMeshGPUTraversalEmulate.GetValueOnRenderThread() && !ShadowCullFrustum)
+	{
+		TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<4>> GPUTraversalDescs = Out.TraversalDescPerView;
+		bool bCanEmulate = true;
+		for (FMeshQuadTree::FTraversalDesc& TraversalDesc : GPUTraversalDescs)
+		{
+			bCanEmulate &= FMeshQuadTreeGPU::MakeGPUTraversalDesc(TraversalDesc);
+		}
+		if (bCanEmulate)
+		{
+			Out.TraversalDescPerView = MoveTemp(GPUTraversalDescs);
+			Out.bEmulateGPUTraversal = true;
+			Out.SharedTraversalMaxObserverDistance = -1.0;
+			for (uint32& ViewKey : Out.ViewKeyPerTraversal)
+			{
+				ViewKey = 0;
+			}
+		}
+	}
+#endif
 }
 
+void FQuadtreeMeshSceneProxy::TraverseViews(FViewTraversals& InOut) const
+{
+	TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<4>>& TraversalDescPerView = InOut.TraversalDescPerView;
+	TArray<FMeshQuadTree::FTraversalOutput, TInlineAllocator<4>>& QuadtreeMeshInstanceDataPerView = InOut.QuadtreeMeshInstanceDataPerView;
+	const TArray<uint32, TInlineAllocator<4>>& ViewKeyPerTraversal = InOut.ViewKeyPerTraversal;
+	const TArray<uint32, TInlineAllocator<4>>& RefreshIntervalPerTraversal = InOut.RefreshIntervalPerTraversal;
+	const double TraversalReuseMargin = InOut.TraversalReuseMargin;
+	const int32 NumBuckets = MeshQuadTree.GetQuadtreeMeshMaterials().Num() * DensityCount;
+
+	// Traverse the tree once per view. Each view fills its own traversal output so the traversals can run as parallel tasks and are joined before the buffer lock
+	SCOPE_CYCLE_COUNTER(STAT_QuadtreeMeshTraversal);
+	TRACE_CPUPROFILER_EVENT_SCOPE(QuadTreeTraversal);
+	const uint64 TraversalStartCycles = FPlatformTime::Cycles64();
+
+	QuadtreeMeshInstanceDataPerView.SetNum(TraversalDescPerView.Num());
+
+	// Reuse the cached traversals that are still valid, the other views are traversed below
+	TArray<int32, TInlineAllocator<4>> TraversalIndices;
+	CachedViewTraversalsCriticalSection.Lock();
+	for (int32 TraversalIndex = 0; TraversalIndex < TraversalDescPerView.Num(); ++TraversalIndex)
+	{
+		const uint32 ViewKey = ViewKeyPerTraversal[TraversalIndex];
+		FMeshQuadTree::FTraversalDesc& TraversalDesc = TraversalDescPerView[TraversalIndex];
+		if (ViewKey != 0)
+		{
+			FCachedViewTraversal* CachedTraversal = CachedViewTraversals.Find(ViewKey);
+			const bool bWithinRefreshInterval = CachedTraversal
+				&& (InOut.FrameNumber - CachedTraversal->TraversedFrameNumber < RefreshIntervalPerTraversal[TraversalIndex])
+				&& (CachedTraversal->Output.BucketInstanceCounts.Num() == NumBuckets);
+			if (CachedTraversal && (bWithinRefreshInterval || CanReuseViewTraversal(*CachedTraversal, TraversalDesc, TraversalReuseMargin)))
+			{
+				INC_DWORD_STAT(STAT_QuadtreeMeshTraversalReuseHits);
+				CopyCachedViewTraversal(*CachedTraversal, TraversalDesc, QuadtreeMeshInstanceDataPerView[TraversalIndex]);
+				CachedTraversal->LastUsedFrameNumber = InOut.FrameNumber;
+				continue;
+			}
+			INC_DWORD_STAT(STAT_QuadtreeMeshTraversalReuseMisses);
+
+			// Cull with a slightly larger frustum, so that the result stays valid while the view moves within the margin
+			for (FPlane& Plane : TraversalDesc.Frustum.Planes)
+			{
+				Plane.W += TraversalReuseMargin;
+			}
+			TraversalDesc.Frustum.Init();
+		}
+		TraversalIndices.Add(TraversalIndex);
+	}
+	// The cache isn't touched while traversing, the other calls can use it meanwhile
+	CachedViewTraversalsCriticalSection.Unlock();
+
+	// Views that only differ by their frustum share one traversal against the union of their frusta
+	TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<1>> SharedTraversalDescs;
+	TArray<int32, TInlineAllocator<4>> SharedTraversalIndexPerTraversal;
+	SharedTraversalIndexPerTraversal.Init(INDEX_NONE, TraversalDescPerView.Num());
+	if (InOut.SharedTraversalMaxObserverDistance >= 0.0)
+	{
+		const double MaxObserverDistance = InOut.SharedTraversalMaxObserverDistance;
+		for (int32 Index = 0; Index < TraversalIndices.Num(); ++Index)
+		{
+			const int32 TraversalIndex = TraversalIndices[Index];
+			if (SharedTraversalIndexPerTraversal[TraversalIndex] != INDEX_NONE)
+			{
+				continue;
+			}
+
+			for (int32 OtherIndex = Index + 1; OtherIndex < TraversalIndices.Num(); ++OtherIndex)
+			{
+				const int32 OtherTraversalIndex = TraversalIndices[OtherIndex];
+				if (SharedTraversalIndexPerTraversal[OtherTraversalIndex] != INDEX_NONE
+					|| !CanShareViewTraversal(TraversalDescPerView[TraversalIndex], TraversalDescPerView[OtherTraversalIndex], MaxObserverDistance))
+				{
+					continue;
+				}
+
+				int32& SharedTraversalIndex = SharedTraversalIndexPerTraversal[TraversalIndex];
+				if (SharedTraversalIndex == INDEX_NONE)
+				{
+					SharedTraversalIndex = SharedTraversalDescs.Num();
+					FMeshQuadTree::FTraversalDesc& SharedTraversalDesc = SharedTraversalDescs.Add_GetRef(TraversalDescPerView[TraversalIndex]);
+					SharedTraversalDesc.Frustum = FConvexVolume();
+					SharedTraversalDesc.UnionFrusta.Add(TraversalDescPerView[TraversalIndex].Frustum);
+				}
+				SharedTraversalIndexPerTraversal[OtherTraversalIndex] = SharedTraversalIndex;
+				SharedTraversalDescs[SharedTraversalIndex].UnionFrusta.Add(TraversalDescPerView[OtherTraversalIndex].Frustum);
+			}
+		}
+	}
+
+	// The views traversed on their own come first, then the shared traversals
+	TArray<int32, TInlineAllocator<4>> SoloTraversalIndices;
+	for (const int32 TraversalIndex : TraversalIndices)
+	{
+		if (SharedTraversalIndexPerTraversal[TraversalIndex] == INDEX_NONE)
+		{
+			SoloTraversalIndices.Add(TraversalIndex);
+		}
+	}
+	TArray<FMeshQuadTree::FTraversalOutput, TInlineAllocator<1>> SharedTraversalOutputs;
+	SharedTraversalOutputs.SetNum(SharedTraversalDescs.Num());
+
+	const int32 NumSoloTraversals = SoloTraversalIndices.Num();
+	const int32 NumTraversals = NumSoloTraversals + SharedTraversalDescs.Num();
+	INC_DWORD_STAT_BY(STAT_QuadtreeMeshTraversedViews, NumTraversals);
+	INC_DWORD_STAT_BY(STAT_QuadtreeMeshSharedTraversalViews, TraversalIndices.Num() - NumSoloTraversals);
+
+	bool bParallelTraversal = (NumTraversals > 1) && InOut.bParallelViewTraversal;
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+	// Debug drawing goes through the collector PDI, which can only be written from one thread
+	for (const FMeshQuadTree::FTraversalDesc& TraversalDesc : TraversalDescPerView)
+	{
+		bParallelTraversal &= (TraversalDesc.DebugShowTile == 0);
+	}
+#endif
+
+	ParallelFor(TEXT("QuadtreeMesh.TraversalPerView"), NumTraversals, 1, [this, &InOut, NumBuckets, NumSoloTraversals, &SoloTraversalIndices, &TraversalDescPerView, &QuadtreeMeshInstanceDataPerView, &SharedTraversalDescs, &SharedTraversalOutputs](int32 Index)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_QuadtreeMeshTraversalPerView);
+		TRACE_CPUPROFILER_EVENT_SCOPE(QuadTreeTraversalPerView);
+
+		const bool bSharedTraversal = (Index >= NumSoloTraversals);
+		const FMeshQuadTree::FTraversalDesc& TraversalDesc = bSharedTraversal ? SharedTraversalDescs[Index - NumSoloTraversals] : TraversalDescPerView[SoloTraversalIndices[Index]];
+		FMeshQuadTree::FTraversalOutput& QuadtreeMeshInstanceData = bSharedTraversal ? SharedTraversalOutputs[Index - NumSoloTraversals] : QuadtreeMeshInstanceDataPerView[SoloTraversalIndices[Index]];
+		QuadtreeMeshInstanceData.Reset(NumBuckets);
+
+		if (InOut.bEmulateGPUTraversal)
+		{
+			FMeshQuadTreeGPU::FTraverseParams TraverseParams;
+			FMeshQuadTreeGPU::BuildTraverseParams(MeshQuadTree, TraversalDesc, InOut.GPUTraversalBucketCapacity, TraverseParams);
+			FMeshQuadTreeGPU::Emulate(MeshQuadTree, TraverseParams, QuadtreeMeshInstanceData);
+		}
+		else
+		{
+			MeshQuadTree.BuildQuadtreeMeshTileInstanceData(TraversalDesc, QuadtreeMeshInstanceData);
+		}
+	}, bParallelTraversal ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	if (SharedTraversalDescs.Num() > 0)
+	{
+		ParallelFor(TEXT("QuadtreeMesh.FilterSharedTraversal"), TraversalIndices.Num(), 1, [this, &TraversalIndices, &SharedTraversalIndexPerTraversal, &TraversalDescPerView, &QuadtreeMeshInstanceDataPerView, &SharedTraversalDescs, &SharedTraversalOutputs](int32 Index)
+		{
+			const int32 TraversalIndex = TraversalIndices[Index];
+			const int32 SharedTraversalIndex = SharedTraversalIndexPerTraversal[TraversalIndex];
+			if (SharedTraversalIndex != INDEX_NONE)
+			{
+				FilterSharedViewTraversal(SharedTraversalOutputs[SharedTraversalIndex], TraversalDescPerView[TraversalIndex], QuadtreeMeshInstanceDataPerView[TraversalIndex]);
+			}
+		}, InOut.bParallelViewTraversal ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+	}
+
+	for (const FMeshQuadTree::FTraversalOutput& QuadtreeMeshInstanceData : QuadtreeMeshInstanceDataPerView)
+	{
+		int32 MaxViewInstanceCount = HistoricalMaxViewInstanceCount.load(std::memory_order_relaxed);
+		while (QuadtreeMeshInstanceData.InstanceCount > MaxViewInstanceCount
+			&& !HistoricalMaxViewInstanceCount.compare_exchange_weak(MaxViewInstanceCount, QuadtreeMeshInstanceData.InstanceCount, std::memory_order_relaxed))
+		{
+		}
+	}
 
+	// Keep the new traversals for the next frames. The outputs are copied since their bucket counts are reused as buffer offsets below
+	CachedViewTraversalsCriticalSection.Lock();
+	for (const int32 TraversalIndex : TraversalIndices)
+	{
+		const uint32 ViewKey = ViewKeyPerTraversal[TraversalIndex];
+		if (ViewKey != 0)
+		{
+			const FMeshQuadTree::FTraversalDesc& TraversalDesc = TraversalDescPerView[TraversalIndex];
+			FCachedViewTraversal& CachedTraversal = CachedViewTraversals.FindOrAdd(ViewKey);
+			CachedTraversal.Output = QuadtreeMeshInstanceDataPerView[TraversalIndex];
+			CachedTraversal.CullingPlanes = TraversalDesc.Frustum.Planes;
+			CachedTraversal.ObserverPosition = TraversalDesc.ObserverPosition;
+			CachedTraversal.TessellatedQuadtreeMeshBounds = TraversalDesc.TessellatedQuadtreeMeshBounds;
+			CachedTraversal.LowestLOD = TraversalDesc.LowestLOD;
+			CachedTraversal.LODBias = TraversalDesc.LODBias;
+			CachedTraversal.ForceCollapseDensityLevel = TraversalDesc.ForceCollapseDensityLevel;
+			CachedTraversal.MinDensityLevel = TraversalDesc.MinDensityLevel;
+			CachedTraversal.TraversedFrameNumber = InOut.FrameNumber;
+			CachedTraversal.LastUsedFrameNumber = InOut.FrameNumber;
+		}
+	}
+
+	// Drop the traversals of views that stopped rendering
+	constexpr uint32 MaxCachedTraversalIdleFrames = 30;
+	for (TMap<uint32, FCachedViewTraversal>::TIterator It(CachedViewTraversals); It; ++It)
+	{
+		if (InOut.FrameNumber - It->Value.LastUsedFrameNumber > MaxCachedTraversalIdleFrames)
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	CachedViewTraversalsCriticalSection.Unlock();
+
+	AdaptiveLOD.TraversalCycles.fetch_add(FPlatformTime::Cycles64() - TraversalStartCycles, std::memory_order_relaxed);
+}
+
+bool FQuadtreeMeshSceneProxy::CanReuseViewTraversal(const FCachedViewTraversal& InCachedTraversal, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, double InMargin) const
+{
+	// The LOD selection is only a function of the observer position, the lowest LOD, the LOD bias, the density levels and the tessellated bounds.
+	// Horizon culling depends on the exact observer position
+	if (InCachedTraversal.LowestLOD != InTraversalDesc.LowestLOD
+		|| InCachedTraversal.LODBias != InTraversalDesc.LODBias
+		|| InCachedTraversal.ForceCollapseDensityLevel != InTraversalDesc.ForceCollapseDensityLevel
+		|| InCachedTraversal.MinDensityLevel != InTraversalDesc.MinDensityLevel
+		|| InCachedTraversal.TessellatedQuadtreeMeshBounds != InTraversalDesc.TessellatedQuadtreeMeshBounds
+		|| !InTraversalDesc.HorizonOccluders.IsEmpty()
+		|| InCachedTraversal.Output.BucketInstanceCounts.Num() != MeshQuadTree.GetQuadtreeMeshMaterials().Num() * DensityCount
+		|| FVector::DistSquared(InCachedTraversal.ObserverPosition, InTraversalDesc.ObserverPosition) > FMath::Square(InMargin))
+	{
+		return false;
+	}
+
+	const TArray<FPlane, TInlineAllocator<6>>& NewPlanes = InTraversalDesc.Frustum.Planes;
+	if (InCachedTraversal.CullingPlanes.Num() != NewPlanes.Num())
+	{
+		return false;
+	}
+
+	// Every tile inside the new frustum must be inside the enlarged one the cached traversal was culled with.
+	// The difference between two plane distances is linear, so its maximum over the tree bounds is exact
+	const FBox TreeBounds = MeshQuadTree.GetBounds();
+	const FVector Center = TreeBounds.GetCenter();
+	const FVector Extent = TreeBounds.GetExtent();
+	for (int32 PlaneIndex = 0; PlaneIndex < NewPlanes.Num(); ++PlaneIndex)
+	{
+		const FPlane& CulledPlane = InCachedTraversal.CullingPlanes[PlaneIndex];
+		const FPlane& NewPlane = NewPlanes[PlaneIndex];
+		const FVector NormalDelta = FVector(CulledPlane) - FVector(NewPlane);
+		const double MaxDistanceDelta = FVector::DotProduct(NormalDelta, Center) + FVector::DotProduct(NormalDelta.GetAbs(), Extent) - (CulledPlane.W - NewPlane.W);
+		if (MaxDistanceDelta > 0.0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FQuadtreeMeshSceneProxy::CopyCachedViewTraversal(const FCachedViewTraversal& InCachedTraversal, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, FMeshQuadTree::FTraversalOutput& Output)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(CopyCachedViewTraversal);
+
+	Output = InCachedTraversal.Output;
+
+	// Positions are relative to the tree origin, only the height morph of the lowest LOD follows the observer
+	for (FMeshQuadTree::FBucketInstanceData& Bucket : Output.BucketInstanceData)
+	{
+		for (FVector4f& Data0 : Bucket.Streams[0])
+		{
+			const int32 LODLevel = static_cast<int32>(std::bit_cast<uint32>(Data0.Z) & 0xFF);
+			Data0.W = (LODLevel == InTraversalDesc.LowestLOD) ? InTraversalDesc.HeightMorph : 0.0f;
+		}
+	}
+}
+
+void FQuadtreeMeshSceneProxy::UpdateAdaptiveLOD(uint32 InFrameNumber) const
+{
+	FScopeLock Lock(&AdaptiveLODCriticalSection);
+
+	if (CVarQuadtreeMeshAdaptive.GetValueOnRenderThread() == 0)
+	{
+		AdaptiveLOD.Reset();
+		return;
+	}
+
+	// Every GetDynamicMeshElements call of a frame adds to the same measurement
+	if (AdaptiveLOD.FrameNumber == InFrameNumber)
+	{
+		return;
+	}
+
+	const int32 TargetVertices = CVarQuadtreeMeshAdaptiveTargetVertices.GetValueOnRenderThread();
+	const float TargetTraversalMs = CVarQuadtreeMeshAdaptiveTargetTraversalMs.GetValueOnRenderThread();
+
+	// The load is the ratio of the measured cost to the target, the most expensive of the two
+	double Load = 0.0;
+	if (AdaptiveLOD.FrameNumber != INDEX_NONE)
+	{
+		if (TargetVertices > 0)
+		{
+			Load = FMath::Max(Load, static_cast<double>(AdaptiveLOD.VertexCount.load(std::memory_order_relaxed)) / TargetVertices);
+		}
+		if (TargetTraversalMs > 0.0f)
+		{
+			Load = FMath::Max(Load, FPlatformTime::ToMilliseconds64(AdaptiveLOD.TraversalCycles.load(std::memory_order_relaxed)) / TargetTraversalMs);
+		}
+	}
+
+	AdaptiveLOD.FrameNumber = InFrameNumber;
+	AdaptiveLOD.VertexCount = 0;
+	AdaptiveLOD.TraversalCycles = 0;
+
+	const int32 MinLODBias = FMath::Max(CVarQuadtreeMeshAdaptiveMinLODBias.GetValueOnRenderThread(), FMeshQuadTree::GetMinLODBias(LODScale, MeshQuadTree.GetLeafSize()));
+	const int32 MaxLODBias = FMath::Max(CVarQuadtreeMeshAdaptiveMaxLODBias.GetValueOnRenderThread(), MinLODBias);
+	const float Hysteresis = FMath::Max(CVarQuadtreeMeshAdaptiveHysteresis.GetValueOnRenderThread(), 0.0f);
+	const int32 ForceCollapseFrames = FMath::Max(CVarQuadtreeMeshAdaptiveForceCollapseFrames.GetValueOnRenderThread(), 1);
+	const bool bForcingCollapse = AdaptiveLOD.ForceCollapseDensityLevel != TNumericLimits<int32>::Max();
+
+	// Density levels above the collapse level render in place of incomplete subtrees
+	const int32 UncollapsedDensityLevel = FMath::Min(ForceCollapseDensityLevel, DensityCount - 1);
+
+	// Nothing to measure when nothing was drawn or there is no target
+	if (Load > 0.0)
+	{
+		const float LogLoad = static_cast<float>(FMath::Log2(Load));
+		const bool bOverTarget = LogLoad > Hysteresis;
+		const bool bUnderTarget = LogLoad < -Hysteresis;
+
+		// Each step of LOD bias doubles the LOD distances, which roughly quadruples the number of tiles: half a step per doubling of the load.
+		// Collapsed density levels are restored before the LOD bias goes back up
+		if (bOverTarget || (bUnderTarget && !bForcingCollapse))
+		{
+			AdaptiveLOD.LODBias -= FMath::Clamp(CVarQuadtreeMeshAdaptiveRate.GetValueOnRenderThread(), 0.0f, 1.0f) * 0.5f * LogLoad;
+		}
+		AdaptiveLOD.LODBias = FMath::Clamp(AdaptiveLOD.LODBias, static_cast<float>(MinLODBias), static_cast<float>(MaxLODBias));
+
+		// Once the LOD bias can't go lower, collapse density levels one at a time
+		if (bOverTarget && AdaptiveLOD.AppliedLODBias <= MinLODBias)
+		{
+			AdaptiveLOD.FramesAtLODBiasLimit = FMath::Max(AdaptiveLOD.FramesAtLODBiasLimit, 0) + 1;
+		}
+		else if (bUnderTarget && bForcingCollapse)
+		{
+			AdaptiveLOD.FramesAtLODBiasLimit = FMath::Min(AdaptiveLOD.FramesAtLODBiasLimit, 0) - 1;
+		}
+		else
+		{
+			AdaptiveLOD.FramesAtLODBiasLimit = 0;
+		}
+
+		if (AdaptiveLOD.FramesAtLODBiasLimit >= ForceCollapseFrames)
+		{
+			AdaptiveLOD.ForceCollapseDensityLevel = FMath::Max(FMath::Min(AdaptiveLOD.ForceCollapseDensityLevel, UncollapsedDensityLevel) - 1, 0);
+			AdaptiveLOD.FramesAtLODBiasLimit = 0;
+		}
+		else if (AdaptiveLOD.FramesAtLODBiasLimit <= -ForceCollapseFrames)
+		{
+			AdaptiveLOD.ForceCollapseDensityLevel += 1;
+			if (AdaptiveLOD.ForceCollapseDensityLevel >= UncollapsedDensityLevel)
+			{
+				AdaptiveLOD.ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+			}
+			AdaptiveLOD.FramesAtLODBiasLimit = 0;
+		}
+	}
+
+	// The traversal only changes once the smoothed bias is clearly closer to another step, so that it doesn't flicker between two
+	if (FMath::Abs(AdaptiveLOD.LODBias - AdaptiveLOD.AppliedLODBias) > 0.5f + Hysteresis)
+	{
+		AdaptiveLOD.AppliedLODBias = FMath::RoundToInt32(AdaptiveLOD.LODBias);
+	}
+	AdaptiveLOD.AppliedLODBias = FMath::Clamp(AdaptiveLOD.AppliedLODBias, MinLODBias, MaxLODBias);
+
+	SET_FLOAT_STAT(STAT_QuadtreeMeshAdaptiveLODBias, AdaptiveLOD.LODBias);
+	const int32 CollapsedDensityLevels = FMath::Max(UncollapsedDensityLevel - AdaptiveLOD.ForceCollapseDensityLevel, 0);
+	SET_DWORD_STAT(STAT_QuadtreeMeshAdaptiveCollapsedDensityLevels, CollapsedDensityLevels);
+	CSV_CUSTOM_STAT_GLOBAL(QuadtreeMeshAdaptiveLODBias, AdaptiveLOD.LODBias, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT_GLOBAL(QuadtreeMeshAdaptiveCollapsedDensityLevels, CollapsedDensityLevels, ECsvCustomStatOp::Set);
+}
+
+bool FQuadtreeMeshSceneProxy::CanShareViewTraversal(const FMeshQuadTree::FTraversalDesc& InTraversalDescA, const FMeshQuadTree::FTraversalDesc& InTraversalDescB, double InMaxObserverDistance)
+{
+#if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
+	// Debug drawing shows the tiles of each traversal
+	if (InTraversalDescA.DebugShowTile != 0 || InTraversalDescB.DebugShowTile != 0)
+	{
+		return false;
+	}
+#endif
+
+	// Budgets spread over the visible tiles, so budgeted traversals depend on the frustum. The horizon only holds for the exact observer position
+	return InTraversalDescA.LowestLOD == InTraversalDescB.LowestLOD
+		&& (InTraversalDescA.HorizonOccluders.IsEmpty() || InTraversalDescA.ObserverPosition == InTraversalDescB.ObserverPosition)
+		&& InTraversalDescA.LODBias == InTraversalDescB.LODBias
+		&& InTraversalDescA.ForceCollapseDensityLevel == InTraversalDescB.ForceCollapseDensityLevel
+		&& InTraversalDescA.MinDensityLevel == InTraversalDescB.MinDensityLevel
+		&& InTraversalDescA.TessellatedQuadtreeMeshBounds == InTraversalDescB.TessellatedQuadtreeMeshBounds
+		&& InTraversalDescA.InstanceBudget == 0 && InTraversalDescB.InstanceBudget == 0
+		&& InTraversalDescA.VertexBudget == 0 && InTraversalDescB.VertexBudget == 0
+		&& FVector::DistSquared(InTraversalDescA.ObserverPosition, InTraversalDescB.ObserverPosition) <= FMath::Square(InMaxObserverDistance);
+}
+
+void FQuadtreeMeshSceneProxy::FilterSharedViewTraversal(const FMeshQuadTree::FTraversalOutput& InSharedOutput, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, FMeshQuadTree::FTraversalOutput& Output) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FilterSharedViewTraversal);
+
+	Output.Reset(InSharedOutput.BucketInstanceCounts.Num());
+
+	// Instances only store the base height of their tile, the Z range of the tree keeps the test conservative
+	const FBox TreeBounds = MeshQuadTree.GetBounds();
+	const double CenterZ = TreeBounds.GetCenter().Z;
+	const double ExtentZ = TreeBounds.GetExtent().Z;
+
+	const FVector TreeOrigin = MeshQuadTree.GetOrigin();
+	const double LeafSize = MeshQuadTree.GetLeafSize();
+
+	for (int32 BucketIndex = 0; BucketIndex < InSharedOutput.BucketInstanceData.Num(); ++BucketIndex)
+	{
+		const FMeshQuadTree::FBucketInstanceData& SharedBucket = InSharedOutput.BucketInstanceData[BucketIndex];
+		FMeshQuadTree::FBucketInstanceData& Bucket = Output.BucketInstanceData[BucketIndex];
+		for (int32 InstanceIndex = 0; InstanceIndex < SharedBucket.Streams[0].Num(); ++InstanceIndex)
+		{
+			const FBox2f TileBounds = FMeshQuadTree::GetInstanceTileBounds(SharedBucket.Streams[0][InstanceIndex]);
+			const FVector TileCenter(FVector2D(TreeOrigin) + FVector2D(TileBounds.GetCenter()) * LeafSize, CenterZ);
+			const FVector TileExtent(FVector2D(TileBounds.GetExtent()) * LeafSize, ExtentZ);
+			if (!InTraversalDesc.Frustum.IntersectBox(TileCenter, TileExtent))
+			{
+				continue;
+			}
+
+			// Positions are relative to the tree origin, only the height morph of the lowest LOD follows the observer of this view, as in CopyCachedViewTraversal
+			for (int32 StreamIndex = 0; StreamIndex < FMeshQuadTree::NumStreams; ++StreamIndex)
+			{
+				Bucket.Streams[StreamIndex].Add(SharedBucket.Streams[StreamIndex][InstanceIndex]);
+			}
+			FVector4f& Data0 = Bucket.Streams[0].Last();
+			const int32 LODLevel = static_cast<int32>(std::bit_cast<uint32>(Data0.Z) & 0xFF);
+			Data0.W = (LODLevel == InTraversalDesc.LowestLOD) ? InTraversalDesc.HeightMorph : 0.0f;
+
+			++Output.BucketInstanceCounts[BucketIndex];
+			++Output.InstanceCount;
+		}
+	}
+}
 
 FPrimitiveViewRelevance FQuadtreeMeshSceneProxy::GetViewRelevance(const FSceneView* View) const
 {
 	FPrimitiveViewRelevance Result;
 	Result.bDrawRelevance = IsShown(View);
-	Result.bShadowRelevance = false;
+	Result.bShadowRelevance = IsShadowCast(View) && (CVarQuadtreeMeshShadows.GetValueOnRenderThread() != 0);
 	Result.bDynamicRelevance = true;
 	Result.bStaticRelevance = false;
 	Result.bRenderInMainPass = ShouldRenderInMainPass();
@@ -408,6 +1486,12 @@ void FQuadtreeMeshSceneProxy::OnTessellatedQuadtreeMeshBoundsChanged_RenderThrea
 	check(IsInRenderingThread());
 
 	TessellatedQuadtreeMeshBounds = InTessellatedWaterMeshBounds;
+
+	// The vertices morph by the same distance the traversal selects LODs with
+	for (FQuadtreeMeshVertexFactory* QuadtreeMeshFactory : QuadtreeMeshVertexFactories)
+	{
+		QuadtreeMeshFactory->SetFocusRegion(TessellatedQuadtreeMeshBounds);
+	}
 }
 
 HHitProxy* FQuadtreeMeshSceneProxy::CreateHitProxies(UPrimitiveComponent* Component,
@@ -435,13 +1519,12 @@ void FQuadtreeMeshSceneProxy::GetDynamicRayTracingInstances(FRayTracingMaterialG
 	const FSceneView& SceneView = *Context.ReferenceView;
 	const FVector ObserverPosition = SceneView.ViewMatrices.GetViewOrigin();
 
-	FQuadtreeMeshLODParams QuadtreeMeshLODParams = GetQuadtreeMeshLODParams(ObserverPosition);
+	FQuadtreeMeshLODParams QuadtreeMeshLODParams = GetQuadtreeMeshLODParams(ObserverPosition, LODScale);
 
 	const int32 NumBuckets = MeshQuadTree.GetQuadtreeMeshMaterials().Num() * DensityCount;
 
 	FMeshQuadTree::FTraversalOutput QuadtreeMeshInstanceData;
-	QuadtreeMeshInstanceData.BucketInstanceCounts.Empty(NumBuckets);
-	QuadtreeMeshInstanceData.BucketInstanceCounts.AddZeroed(NumBuckets);
+	QuadtreeMeshInstanceData.Reset(NumBuckets);
 
 	FMeshQuadTree::FTraversalDesc TraversalDesc;
 	TraversalDesc.LowestLOD = QuadtreeMeshLODParams.LowestLOD;
@@ -449,7 +1532,6 @@ void FQuadtreeMeshSceneProxy::GetDynamicRayTracingInstances(FRayTracingMaterialG
 	TraversalDesc.LODCount = MeshQuadTree.GetTreeDepth();
 	TraversalDesc.DensityCount = DensityCount;
 	TraversalDesc.ForceCollapseDensityLevel = ForceCollapseDensityLevel;
-	TraversalDesc.PreViewTranslation = SceneView.ViewMatrices.GetPreViewTranslation();
 	TraversalDesc.ObserverPosition = ObserverPosition;
 	TraversalDesc.Frustum = FConvexVolume(); // Default volume to disable frustum culling
 	TraversalDesc.LODScale = LODScale;
@@ -479,20 +1561,6 @@ void FQuadtreeMeshSceneProxy::GetDynamicRayTracingInstances(FRayTracingMaterialG
 		SetupRayTracingInstances(Context.GraphBuilder.RHICmdList, DensityInstanceCount, DensityIndex);
 	}
 
-	// Create per-bucket prefix sum and sort instance data so we can easily access per-instance data for each density
-	TArray<int32> BucketOffsets;
-	BucketOffsets.SetNumZeroed(NumBuckets);
-
-	for (int32 BucketIndex = 1; BucketIndex < NumBuckets; ++BucketIndex)
-	{
-		BucketOffsets[BucketIndex] = BucketOffsets[BucketIndex - 1] + QuadtreeMeshInstanceData.BucketInstanceCounts[BucketIndex - 1];
-	}
-	
-	QuadtreeMeshInstanceData.StagingInstanceData.StableSort([](const FMeshQuadTree::FStagingInstanceData& Lhs, const FMeshQuadTree::FStagingInstanceData& Rhs)
-		{
-			return Lhs.BucketIndex < Rhs.BucketIndex;
-		});
-
 	FMeshBatch BaseMesh;
 	BaseMesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
 	BaseMesh.Type = PT_TriangleList;
@@ -542,15 +1610,12 @@ void FQuadtreeMeshSceneProxy::GetDynamicRayTracingInstances(FRayTracingMaterialG
 				using FQuadtreeMeshVertexFactoryUserDataWrapperType = FQuadtreeMeshVertexFactoryUserDataWrapper;
 				FQuadtreeMeshVertexFactoryUserDataWrapperType& UserDataWrapper = Context.RayTracingMeshResourceCollector.AllocateOneFrameResource<FQuadtreeMeshVertexFactoryUserDataWrapperType>();
 
-				const int32 InstanceDataIndex = BucketOffsets[BucketIndex] + InstanceIndex;
-				const FMeshQuadTree::FStagingInstanceData& InstanceData = QuadtreeMeshInstanceData.StagingInstanceData[InstanceDataIndex];
+				const FMeshQuadTree::FBucketInstanceData& Bucket = QuadtreeMeshInstanceData.BucketInstanceData[BucketIndex];
 
 				FQuadtreeMeshVertexFactoryRaytracingParameters UniformBufferParams;
 				UniformBufferParams.VertexBuffer = QuadtreeMeshVertexFactories[DensityIndex]->VertexBuffer->GetSRV();
-				UniformBufferParams.InstanceData0 = InstanceData.Data[0];
-				UniformBufferParams.InstanceData1 = InstanceData.Data[1];
+				UniformBufferParams.InstanceData0 = Bucket.Streams[0][InstanceIndex];
 
-				UserDataWrapper.UserData.InstanceDataBuffers = QuadtreeMeshUserDataBuffers->GetUserData(EQuadtreeMeshRenderGroupType::RG_RenderQuadtreeMeshTiles)->InstanceDataBuffers;
 				UserDataWrapper.UserData.RenderGroupType = EQuadtreeMeshRenderGroupType::RG_RenderQuadtreeMeshTiles;
 				UserDataWrapper.UserData.QuadtreeMeshVertexFactoryRaytracingVFUniformBuffer = FQuadtreeMeshVertexFactoryRaytracingParametersRef::CreateUniformBufferImmediate(UniformBufferParams, UniformBuffer_SingleFrame);
 							
@@ -626,13 +1691,13 @@ void FQuadtreeMeshSceneProxy::SetupRayTracingInstances(FRHICommandListBase& RHIC
 
 
 FQuadtreeMeshSceneProxy::FQuadtreeMeshLODParams FQuadtreeMeshSceneProxy::GetQuadtreeMeshLODParams(
-	const FVector& Position) const
+	const FVector& Position, float InLODScale) const
 {
 	float QuadtreeMeshHeightForLOD = 0.0f;
 	MeshQuadTree.QueryInterpolatedTileBaseHeightAtLocation(FVector2D(Position), QuadtreeMeshHeightForLOD);
 
 	// Need to let the lowest LOD morph globally towards the next LOD. When the LOD is done morphing, simply clamp the LOD in the LOD selection to effectively promote the lowest LOD to the same LOD level as the one above
-	float DistToQuadtreeMesh = FMath::Abs(Position.Z - QuadtreeMeshHeightForLOD) / LODScale;
+	float DistToQuadtreeMesh = FMath::Abs(Position.Z - QuadtreeMeshHeightForLOD) / InLODScale;
 	DistToQuadtreeMesh = FMath::Max(DistToQuadtreeMesh - 2.0f, 0.0f);
 	DistToQuadtreeMesh *= 2.0f;
 
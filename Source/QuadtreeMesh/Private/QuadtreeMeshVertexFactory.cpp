@@ -54,9 +54,18 @@ public:
 				FVertexInputStream* InstanceInputStream = VertexStreams.FindByPredicate([i](const FVertexInputStream& InStream) { return InStream.StreamIndex == i+1; });
 				check(InstanceInputStream);
 				
-				// Bind vertex buffer
-				check(InstanceDataBuffers->GetBuffer(i));
-				InstanceInputStream->VertexBuffer = InstanceDataBuffers->GetBuffer(i);
+				// Bind vertex buffer. The ray tracing instances read their instance data from a uniform buffer and have no streams of their own
+				if (InstanceDataBuffers)
+				{
+					check(InstanceDataBuffers->GetBuffer(i));
+					InstanceInputStream->VertexBuffer = InstanceDataBuffers->GetBuffer(i);
+					InstanceInputStream->Offset = InstanceDataBuffers->GetBufferOffset(i);
+				}
+				else
+				{
+					InstanceInputStream->VertexBuffer = GNullVertexBuffer.VertexBufferRHI;
+					InstanceInputStream->Offset = 0;
+				}
 			}
 			const int32 InstanceOffsetValue = BatchElement.UserIndex;
 			if (InstanceOffsetValue > 0)
@@ -67,10 +76,13 @@ public:
 	}
 };
 
-FQuadtreeMeshVertexFactory::FQuadtreeMeshVertexFactory(ERHIFeatureLevel::Type InFeatureLevel, int32 InNumQuadsPerSide, float InLODScale)
+FQuadtreeMeshVertexFactory::FQuadtreeMeshVertexFactory(ERHIFeatureLevel::Type InFeatureLevel, int32 InNumQuadsPerSide, float InLODScale, float InLeafSize, const FVector& InTreeOrigin, const FBox2D& InFocusRegion)
 	: FVertexFactory(InFeatureLevel)
 	, NumQuadsPerSide(InNumQuadsPerSide)
 	, LODScale(InLODScale)
+	, LeafSize(InLeafSize)
+	, TreeOrigin(InTreeOrigin)
+	, FocusRegion(InFocusRegion)
 {
 	VertexBuffer = new FQuadtreeMeshVertexBuffer(NumQuadsPerSide);
 	IndexBuffer = new FQuadtreeMeshIndexBuffer(NumQuadsPerSide);
@@ -159,12 +171,35 @@ void FQuadtreeMeshVertexFactory::SetupUniformDataForGroup(EQuadtreeMeshRenderGro
 	FQuadtreeMeshVertexFactoryParameters UniformParams;
 	UniformParams.NumQuadsPerTileSide = NumQuadsPerSide;
 	UniformParams.LODScale = LODScale;
+	UniformParams.LeafSize = LeafSize;
+	// Split in two floats, the shader adds the origin to the pre view translation like any large world position
+	UniformParams.TreeOriginHigh = FVector3f(TreeOrigin);
+	UniformParams.TreeOriginLow = FVector3f(TreeOrigin - FVector(UniformParams.TreeOriginHigh));
 	UniformParams.bRenderSelected = (InRenderGroupType != EQuadtreeMeshRenderGroupType::RG_RenderUnselectedQuadtreeMeshTilesOnly);
 	UniformParams.bRenderUnselected = (InRenderGroupType != EQuadtreeMeshRenderGroupType::RG_RenderSelectedQuadtreeMeshTilesOnly);
+	// Relative to the tree origin, small enough for floats
+	UniformParams.bHasFocusRegion = FocusRegion.bIsValid ? 1 : 0;
+	UniformParams.FocusRegion = FocusRegion.bIsValid
+		? FVector4f(FVector2f(FocusRegion.Min - FVector2D(TreeOrigin)), FVector2f(FocusRegion.Max - FVector2D(TreeOrigin)))
+		: FVector4f::Zero();
 	UniformBuffers[static_cast<int32>(InRenderGroupType)] = FQuadtreeMeshVertexFactoryBufferRef::CreateUniformBufferImmediate(UniformParams, UniformBuffer_MultiFrame);
 }
 
 
+void FQuadtreeMeshVertexFactory::SetFocusRegion(const FBox2D& InFocusRegion)
+{
+	check(IsInRenderingThread());
+
+	FocusRegion = InFocusRegion;
+	if (IsInitialized())
+	{
+		SetupUniformDataForGroup(EQuadtreeMeshRenderGroupType::RG_RenderQuadtreeMeshTiles);
+		SetupUniformDataForGroup(EQuadtreeMeshRenderGroupType::RG_RenderSelectedQuadtreeMeshTilesOnly);
+		SetupUniformDataForGroup(EQuadtreeMeshRenderGroupType::RG_RenderUnselectedQuadtreeMeshTilesOnly);
+	}
+}
+
+
 bool FQuadtreeMeshVertexFactory::ShouldCompilePermutation(const FVertexFactoryShaderPermutationParameters& Parameters)
 {
 	const bool bIsCompatibleWithQuadtreeMesh = Parameters.MaterialParameters.MaterialDomain == MD_Surface || Parameters.MaterialParameters.bIsSpecialEngineMaterial;
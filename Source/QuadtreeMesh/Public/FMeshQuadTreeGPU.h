@@ -1,7 +1,107 @@
 #pragma once
 
+#include "MeshQuadTree.h"
+#include "RenderGraphResources.h"
+
+class FRDGBuilder;
+
+/**
+ *	Traversal of a FMeshQuadTree in compute shaders. The compact nodes are uploaded once, then each traversal selects and culls the tiles of one view level by level,
+ *	one thread per work item, and writes the instance data and the indirect draw arguments of every bucket without any readback. The kernels are in QuadtreeMeshTraversal.usf.
+ *	Emulate() runs the same kernels on the CPU so that their output can be checked against BuildQuadtreeMeshTileInstanceData on machines without a GPU.
+ */
 class FMeshQuadTreeGPU
 {
 public:
-	
+	/** Largest number of planes a traversal is culled against, QUADTREE_MESH_MAX_PLANES in the kernels */
+	static constexpr int32 MaxPlanes = 16;
+
+	/** Largest number of LOD levels, QUADTREE_MESH_MAX_LODS in the kernels */
+	static constexpr int32 MaxLODs = 20;
+
+	/** Traversal parameters of one view, derived from a FTraversalDesc the same way FTraversalContext derives its own. Shared by the kernels and their emulation */
+	struct FTraverseParams
+	{
+		/** Frustum planes in tile space, XYZ is the normal and W the distance */
+		TArray<FVector4f, TInlineAllocator<MaxPlanes>> Planes;
+
+		/** Squared LOD distances in tile space, indexed by LOD level */
+		TArray<float, TInlineAllocator<MaxLODs>> SquaredLODDistances;
+
+		/** Two entries per render data of the tree: (base height above the tree origin, has material, selected, unused) and the hit proxy color */
+		TArray<FVector4f> RenderData;
+
+		/** Region the LOD distances are measured to in tile space, see FTraversalContext::LODRegion */
+		FBox2f LODRegion = FBox2f(ForceInit);
+
+		float ZStep = 0.0f;
+
+		int32 TreeDepth = 0;
+		int32 LowestLOD = 0;
+		int32 DensityCount = 0;
+		int32 ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+		int32 MinDensityLevel = 0;
+		int32 LODBias = 0;
+		float HeightMorph = 0.0f;
+		bool bLODMorphingEnabled = true;
+
+		int32 NumBuckets = 0;
+		/** Instances written per bucket, the instances past it are dropped */
+		int32 BucketCapacity = 0;
+		/** Work items per level of the traversal, the items past it are dropped */
+		int32 ItemCapacity = 0;
+	};
+
+	/** Buffers written by one traversal, valid until the traversals of the next frame are added */
+	struct FTraversalResult
+	{
+		/** Bucket B starts at instance B * BucketCapacity in each stream */
+		FRHIBuffer* InstanceBuffers[FMeshQuadTree::NumStreams] = {};
+		/** One FRHIDrawIndexedIndirectParameters per bucket */
+		FRHIBuffer* IndirectArgsBuffer = nullptr;
+		int32 BucketCapacity = 0;
+
+		bool IsValid() const { return IndirectArgsBuffer != nullptr; }
+	};
+
+	/**
+	 *	Turn off the options of InOutTraversalDesc that only the CPU traversal has, like footprint and horizon culling or budgets. Both traversals select the same tiles with the resulting desc.
+	 *	Returns false if the view can't be traversed on the GPU at all.
+	 */
+	static bool MakeGPUTraversalDesc(FMeshQuadTree::FTraversalDesc& InOutTraversalDesc);
+
+	static void BuildTraverseParams(const FMeshQuadTree& InTree, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, int32 InBucketCapacity, FTraverseParams& OutParams);
+
+	/** Upload the nodes if needed and add the passes of one traversal to the graph. Every bucket is then drawn with one indirect draw. Render thread only */
+	FTraversalResult Traverse(FRDGBuilder& GraphBuilder, const FMeshQuadTree& InTree, const FTraverseParams& InParams, const TArray<uint32>& InBucketIndexCounts, uint32 InFrameNumber);
+
+	/** CPU reference of the kernels: runs their threads one after the other, in thread order. Output is in the format of BuildQuadtreeMeshTileInstanceData */
+	static void Emulate(const FMeshQuadTree& InTree, const FTraverseParams& InParams, FMeshQuadTree::FTraversalOutput& Output);
+
+	/** Ensure that Emulate() selects the same instances as BuildQuadtreeMeshTileInstanceData for a desc made by MakeGPUTraversalDesc. The order within buckets isn't compared, it differs by design */
+	static bool ValidateEmulation(const FMeshQuadTree& InTree, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, int32 InBucketCapacity);
+
+	bool IsInitialized() const { return NodesBuffer.IsValid(); }
+
+	void Release();
+
+	uint32 GetAllocatedSize() const;
+
+private:
+	/** Nodes in the layout of FQuadtreeMeshNode in the shader: (TileX | TileY << 16, FirstChild, QuadtreeMeshIndex | Level << 16 | ChildMask << 21 | HasCompleteSubtree << 25 | IsSubtreeSameQuadtreeMesh << 26, QuantizedMinZ | QuantizedMaxZ << 10) */
+	static void BuildNodes(const FMeshQuadTree& InTree, TArray<FUintVector4>& OutNodes);
+
+	/** Buffers of one traversal. Kept across frames and reused by the traversals of the next frame in the same order */
+	struct FTraversalBuffers
+	{
+		TRefCountPtr<FRDGPooledBuffer> InstanceBuffers[FMeshQuadTree::NumStreams];
+		TRefCountPtr<FRDGPooledBuffer> IndirectArgsBuffer;
+		int32 NumBuckets = 0;
+		int32 BucketCapacity = 0;
+	};
+
+	TRefCountPtr<FRDGPooledBuffer> NodesBuffer;
+	TArray<FTraversalBuffers> TraversalBuffers;
+	int32 NumUsedTraversalBuffers = 0;
+	uint32 FrameNumber = INDEX_NONE;
 };
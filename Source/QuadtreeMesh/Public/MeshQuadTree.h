@@ -1,10 +1,13 @@
 ﻿#pragma once
 
+#include <bit>
+
 
 class UQuadtreeMeshComponent;
 class FMaterialRenderProxy;
 class UMaterialInterface;
 class HHitProxy;
+class FMeshQuadTreeGPU;
 
 struct FQuadtreeMeshRenderData
 {
@@ -32,12 +35,13 @@ struct FMeshQuadTree
 {
 	enum { INVALID_PARENT = 0xFFFFFFF };
 
-	static constexpr int32 NumStreams =  3 ;
+	/** The hit proxy stream is only bound in the editor, the packed stream is all a cooked game uploads */
+	static constexpr int32 NumStreams = WITH_EDITOR ? 2 : 1;
 
-	struct FStagingInstanceData
+	/** Instances of one bucket, one array per stream so that each stream of the bucket is copied to the instance buffers in one block */
+	struct FBucketInstanceData
 	{
-		int32 BucketIndex;
-		FVector4f Data[NumStreams];
+		TArray<FVector4f> Streams[NumStreams];
 	};
 
 	struct FTraversalOutput
@@ -45,16 +49,20 @@ struct FMeshQuadTree
 		TArray<int32> BucketInstanceCounts;
 
 		/**
-		 *	This is the raw data that will be bound for the draw call through a buffer. Stored in buckets sorted by material and density level
+		 *	This is the raw data that will be bound for the draw call through a buffer, one entry per bucket, indexed like BucketInstanceCounts by material and density level
 		 *	Each instance contains:
-		 *	[0] (xyz: translate, w: wave param index)
-		 *	[1] (x: (bit 0-7)lod level, (bit 8)bShouldMorph, y: HeightMorph zw: scale)
-		 *  [2] (editor only, HitProxy ID of the associated WaterBody actor)
+		 *	[0] (x: (bit 0-15)tile X, (bit 16-31)tile Y of the min corner in leaf tiles from GetOrigin(), y: base height above GetOrigin(),
+		 *	     z: (bit 0-7)lod level, (bit 8)bShouldMorph, (bit 9)bCanMorphTwice, (bit 10-14)tile level, (bit 16-23)signed LOD bias, (bit 24-31)wave param index, w: HeightMorph)
+		 *  [1] (editor only, HitProxy ID of the associated WaterBody actor)
+		 *	Nothing in it depends on the view, the vertex factory adds the tree origin in translated world space
 		 */
-		TArray<FStagingInstanceData> StagingInstanceData;
+		TArray<FBucketInstanceData> BucketInstanceData;
 
 		/** Number of added instances */
 		int32 InstanceCount = 0;
+
+		/** Empty the output for a traversal into InNumBuckets buckets. The allocations of the buckets are kept */
+		void Reset(int32 InNumBuckets);
 	};
 
 
@@ -65,17 +73,50 @@ struct FMeshQuadTree
 		int32 DensityCount = 0;
 		float HeightMorph = 0.0f;
 		int32 ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+		/** Tiles are rendered at this density level or a coarser one */
+		int32 MinDensityLevel = 0;
 		float LODScale = 1.0;
+		/** Shifts the LOD distances by a power of two: LOD L uses GetLODDistance(L + LODBias). Passed to the shader so that morphing follows the same distances */
+		int32 LODBias = 0;
 		FVector ObserverPosition = FVector::ZeroVector;
-		FVector PreViewTranslation = FVector::ZeroVector;
 		FConvexVolume Frustum;
 		bool bLODMorphingEnabled = true;
+		/** Focus region on XY in world space. When valid, LOD distances are measured to it instead of to the observer: tiles touching it are at full density and the LODs get coarser away from it */
 		FBox2D TessellatedQuadtreeMeshBounds = FBox2D(ForceInit);
 
+		/** Number of levels below the root after which subtrees are traversed as parallel tasks. 0 means the whole tree is traversed serially */
+		int32 ParallelSplitDepth = 0;
+
+		/** Cull against the 2D footprint of the frustum on the Z slab of the tree instead of the 3D frustum planes */
+		bool bFootprintCulling = false;
+		/** World space boxes that hide the tiles behind them as seen from the observer. Only boxes that reach down to the bottom of the tree are used */
+		TArray<FBox> HorizonOccluders;
+		/** Frusta of the views sharing this traversal. When set, Frustum should be empty and the nodes are culled against the footprint of their union only */
+		TArray<FConvexVolume> UnionFrusta;
+		/** Nodes with a larger Z range (in world units) are still culled against the 3D frustum planes when bFootprintCulling is set */
+		float FootprintMaxZRange = 0.0f;
+
+		/** Select the tiles of complete subtrees directly from the LOD rings around the LOD region instead of walking their implicit children */
+		bool bAnalyticCompleteRegions = false;
+
+		/** Sort the output by distance to the observer. Without it, tiles are only roughly front to back since children are visited nearest first */
+		bool bSortFrontToBack = false;
+
+		/** 
+		 *	Maximum number of instances and drawn vertices of the traversal, 0 for no limit. When set, nodes are refined in order of screen space error and nodes that don't fit in the budget are rendered at a coarser LOD. 
+		 *	The budget can't go below the cheapest cover of the visible tiles.
+		 */
+		int32 InstanceBudget = 0;
+		int64 VertexBudget = 0;
+		/** Vertex count of a tile per density level, needed by VertexBudget */
+		TArray<int32, TInlineAllocator<8>> DensityVertexCounts;
+
 #if !(UE_BUILD_SHIPPING || UE_BUILD_TEST)
 		// Debug
 		int32 DebugShowTile = 0;
 		class FPrimitiveDrawInterface* DebugPDI = nullptr;
+		/** Run the serial traversal as well when the parallel one is used and check that both produce identical output */
+		bool bValidateParallelTraversal = false;
 #endif
 	};
 
@@ -110,13 +151,14 @@ public:
 	/** Walks down the tree and returns the tile bounds at InWorldLocationXY in OutWorldBounds. Returns true if the query finds a leaf tile to return, otherwise false. */
 	bool QueryTileBoundsAtLocation(const FVector2D& InWorldLocationXY, FBox& OutWorldBounds) const;
 
+	/** The tree is built the same way, but views are traversed by FMeshQuadTreeGPU in compute shaders instead of BuildQuadtreeMeshTileInstanceData where the GPU traversal supports them */
 	bool IsGPUQuadTree() const { return bIsGPUQuadTree; }
 
 	/** Add water body render data to this tree. Returns the index in the array. Use this index to add tiles with this water body to the tree, see AddWaterTilesInsideBounds(..) */
 	uint32 AddQuadtreeMeshRenderData(const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData) { return NodeData.QuadtreeMeshRenderData.Add(InQuadtreeMeshRenderData); }
 
 	/** Get bounds of the root node if there is one, otherwise some default box */
-	FBox GetBounds() const { return NodeData.Nodes.Num() > 0 ? NodeData.Nodes[0].Bounds : FBox(-FVector::OneVector, FVector::OneVector); }
+	FBox GetBounds() const;
 	
 	/** Return the 2D region containing water tiles. Tiles can not be generated outside of this region */
 	FBox2D GetTileRegion() const { return TileRegion; }
@@ -127,6 +169,18 @@ public:
 	/** Get cached leaf world size of one side of the tile (same applies for X and Y) */
 	float GetLeafSize() const { return LeafSize; }
 
+	/** World position of tile (0, 0) at the bottom of the tree. Instance positions are relative to it */
+	FVector GetOrigin() const { return FVector(TileRegion.Min, MinZ); }
+
+	/** Bounds of the tile of an instance in leaf tiles from GetOrigin(), unpacked from its first stream */
+	static FBox2f GetInstanceTileBounds(const FVector4f& InData0)
+	{
+		const uint32 PackedTile = std::bit_cast<uint32>(InData0.X);
+		const uint32 Level = (std::bit_cast<uint32>(InData0.Z) >> 10) & 0x1F;
+		const FVector2f TileMin(static_cast<float>(PackedTile & 0xFFFF), static_cast<float>(PackedTile >> 16));
+		return FBox2f(TileMin, TileMin + FVector2f(static_cast<float>(1u << Level)));
+	}
+
 	/** Number of maximum leaf nodes on one side, same applies for X and Y. (Maximum number of total leaf nodes in this tree is LeafSideCount*LeafSideCount) */
 	int32 GetMaxLeafCount() const { return MaxLeafCount; }
 
@@ -137,11 +191,21 @@ public:
 	/** Calculate the world distance to a LOD */
 	static float GetLODDistance(int32 InLODLevel, float InLODScale) { return FMath::Pow(2.0f, static_cast<float>(InLODLevel + 1)) * InLODScale; }
 
+	/** Lowest LOD bias that keeps the biased LOD scale at or above the tightest one morphing supports, half a leaf */
+	static int32 GetMinLODBias(float InLODScale, float InLeafSize);
+
+	/**
+	 *	LOD bias for a screen space error metric. A tile of LOD L rendered with InNumQuadsPerTileSide quads starts at a distance of GetLODDistance(L - 1), where its quads are the largest on screen.
+	 *	Solving for the LOD scale that makes them InTargetPixels wide there gives InLeafSize * InProjectionScale / (InNumQuadsPerTileSide * InTargetPixels), rounded to a power of two of InLODScale.
+	 *	InProjectionScale is the size in pixels of one world unit seen at a distance of one. The bias never goes below the tightest LOD scale that morphing supports
+	 */
+	static int32 GetScreenSpaceErrorLODBias(float InLODScale, float InLeafSize, int32 InNumQuadsPerTileSide, double InProjectionScale, float InTargetPixels);
+
 	uint32 GetAllocatedSize() const { return NodeData.GetAllocatedSize() + QuadtreeMeshMaterials.GetAllocatedSize(); }
 
 private:
-	
-	
+	/** Uploads the compact nodes and mirrors FTraversalContext in its kernels */
+	friend class FMeshQuadTreeGPU;
 	
 	int32 TreeDepth = 0;
 
@@ -151,43 +215,86 @@ private:
 	FBox2D TileRegion;
 	TArray<FMaterialRenderProxy*> QuadtreeMeshMaterials;
 
+	/** World Z range of the whole tree. Node Z ranges are quantized within it */
+	double MinZ = 0.0;
+	double MaxZ = 0.0;
+
 	bool bIsReadOnly = true;
 	bool bIsGPUQuadTree = false;
 
-	
 	struct FNodeData;
+	struct FNode;
+	struct FTraversalContext;
+	struct FTraversalItem;
 
-	struct FNode
+	/** Convert the build nodes to the compact read-only node array. Children of a node are stored contiguously */
+	void BuildCompactNodes();
+
+	/** Recursive function to convert a build node and its subtree. InNodeIndex must already be allocated in the compact array */
+	void BuildCompactNode(uint32 InBuildNodeIndex, uint32 InNodeIndex, uint32 InTileX, uint32 InTileY, uint32 InLevel);
+
+	/** Order of the compact nodes in memory. Siblings are always contiguous, the layout decides where each group of siblings goes */
+	enum class ENodeLayout : uint8
 	{
+		/** Each group of siblings is followed by the subtrees of its nodes. This is the order BuildCompactNodes() produces */
+		DepthFirst,
+		/** Level by level, the top levels visited by every traversal are packed together */
+		BreadthFirst,
+		/** Van Emde Boas: recursively split the tree at half its height and store the top half before the bottom subtrees, so a root to leaf path touches few cache lines at any scale */
+		VanEmdeBoas,
+	};
 
-		FNode() : QuadtreeMeshIndex(0), TransitionQuadtreeMeshIndex(0), ParentIndex(INVALID_PARENT), HasCompleteSubtree(1), IsSubtreeSameQuadtreeMesh(1), HasMaterial(0) {}
+	/** Renumber the compact nodes in InLayout order */
+	void RelayoutNodes(ENodeLayout InLayout);
 
-		/** If this node is allowed to be rendered, it means it can be rendered in place of all leaf nodes in its subtree. */
-		bool CanRender(int32 InDensityLevel, int32 InForceCollapseDensityLevel, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData) const;
+	/** World bounds of a compact node */
+	FBox GetNodeBounds(const FNode& InNode) const;
+
+	/** Options of the traversal that are resolved at compile time, so that the inner loop doesn't test them per node */
+	template<bool bInCull, bool bInMorph, bool bInHitProxies, bool bInDebug, bool bInCountOnly = false>
+	struct TTraversalPolicy
+	{
+		/** Test nodes against the frustum and the horizon. Off when there are no planes and no occluders, like for ray tracing */
+		static constexpr bool bCull = bInCull;
+		/** Let tiles morph to the next LOD */
+		static constexpr bool bMorph = bInMorph;
+		/** Output the hit proxy colors of the editor */
+		static constexpr bool bHitProxies = bInHitProxies;
+		/** Draw the selected tiles */
+		static constexpr bool bDebug = bInDebug;
+		/** Only count the instances per bucket, without writing their data. Used to measure the cost of a selection */
+		static constexpr bool bCountOnly = bInCountOnly;
+	};
+
+	/** Each bit of InPolicyIndex enables one option of TTraversalPolicy. Options that don't exist in this build configuration are always off, so their variants aren't compiled */
+	template<uint32 InPolicyIndex>
+	using TTraversalPolicyFromIndex = TTraversalPolicy<(InPolicyIndex & 1) != 0, (InPolicyIndex & 2) != 0, WITH_EDITOR && (InPolicyIndex & 4) != 0, !(UE_BUILD_SHIPPING || UE_BUILD_TEST) && (InPolicyIndex & 8) != 0>;
 
-		/** Add instance for rendering this node*/
-		void AddNodeForRender(const FNodeData& InNodeData, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData, int32 InDensityLevel, int32 InLODLevel, const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const;
+	/** BuildQuadtreeMeshTileInstanceData for one traversal policy */
+	template<typename TPolicy>
+	void BuildQuadtreeMeshTileInstanceDataWithPolicy(const FTraversalContext& InContext, FTraversalOutput& Output) const;
 
-		/** Recursive function to traverse down to the appropriate density level. The LODLevel is constant here since this function is only called on tiles that are fully inside a LOD range */
-		void SelectLODRefinement(const FNodeData& InNodeData, int32 InDensityLevel, int32 InLODLevel, const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const;
+	/** Split the traversal in subtrees at InTraversalDesc.ParallelSplitDepth, traverse them as parallel tasks and merge their output in serial traversal order */
+	template<typename TPolicy>
+	void BuildQuadtreeMeshTileInstanceDataParallel(const FTraversalContext& InContext, const FTraversalItem& InRootItem, FTraversalOutput& Output) const;
 
-		/** Recursive function to select nodes visible from the current point of view */
-		void SelectLOD(const FNodeData& InNodeData, int32 InLODLevel, const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const;
+	/** Number of quantization steps for the node Z ranges */
+	static constexpr uint32 ZQuantizationMax = (1u << 10) - 1;
 
-		/** Recursive function to select nodes visible from the current point of view within an active bounding box */
-		void SelectLODWithinBounds(const FNodeData& InNodeData, int32 InLODLevel, const FTraversalDesc& InTraversalDesc, FTraversalOutput& Output) const;
+	/** Deepest tree whose tile coordinates fit in the 16 bits of the compact node */
+	static constexpr int32 MaxTreeDepth = 16;
 
-		/** Recursive function to query the height(prior to any displacement) at a given location, return false if no height could be found */
-		bool QueryBaseHeightAtLocation(const FNodeData& InNodeData, const FVector2D& InWorldLocationXY, float& OutHeight) const;
+	/** Node used while the tree is unlocked for insertion. Converted to the compact FNode when the tree is unlocked to be read-only */
+	struct FBuildNode
+	{
 
-		/** Recursive function to query the bounds of a tile at a given location, return false if no leaf node could be found */
-		bool QueryBoundsAtLocation(const FNodeData& InNodeData, const FVector2D& InWorldLocationXY, FBox& OutBounds) const;
+		FBuildNode() : QuadtreeMeshIndex(0), TransitionQuadtreeMeshIndex(0), ParentIndex(INVALID_PARENT), HasCompleteSubtree(1), IsSubtreeSameQuadtreeMesh(1), HasMaterial(0) {}
 
 		/** Add nodes that intersect InMeshBounds. LODLevel is the current level. This is the only method used to generate the tree */
 		void AddNodes(FNodeData& InNodeData, const FBox& InMeshBounds, const FBox& InQuadtreeMeshBounds, uint32 InQuadtreeMeshIndex, int32 InLODLevel, uint32 InParentIndex);
 		
 		/** Check if all conditions are met to potentially allow this and another node to render as one */
-		bool CanMerge(const FNode& Other) const { return Other.QuadtreeMeshIndex == QuadtreeMeshIndex && Other.TransitionQuadtreeMeshIndex == TransitionQuadtreeMeshIndex; }
+		bool CanMerge(const FBuildNode& Other) const { return Other.QuadtreeMeshIndex == QuadtreeMeshIndex && Other.TransitionQuadtreeMeshIndex == TransitionQuadtreeMeshIndex; }
 
 		/** World bounds */
 		FBox Bounds = FBox(-FVector::OneVector, FVector::OneVector);
@@ -216,18 +323,279 @@ private:
 		uint32 Children[4] = { 0, 0, 0, 0 };
 	};
 
+	/** 
+	 *	Compact read-only node. Bounds are implicit: XY come from the integer tile coordinates and level (in leaf tiles from TileRegion.Min), 
+	 *	Z is quantized within the Z range of the tree. Children are stored contiguously starting at FirstChild, one per bit set in ChildMask.
+	 */
+	struct FNode
+	{
+
+		FNode() : Level(0), ChildMask(0), HasCompleteSubtree(1), IsSubtreeSameQuadtreeMesh(1), HasMaterial(0), QuantizedMinZ(0), QuantizedMaxZ(0) {}
+
+		/** If this node is allowed to be rendered, it means it can be rendered in place of all leaf nodes in its subtree. */
+		bool CanRender(int32 InDensityLevel, int32 InForceCollapseDensityLevel, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData) const;
+
+		/** Stored child node containing InTileLocationXY if there is one */
+		const FNode* FindChildAtLocation(const FNodeData& InNodeData, const FVector2D& InTileLocationXY) const;
+
+		/** If children are implicit, they are generated during traversal instead of being stored in the node array */
+		bool HasImplicitChildren() const { return HasCompleteSubtree && IsSubtreeSameQuadtreeMesh; }
+
+		/** Number of stored children */
+		uint32 GetChildCount() const { return FMath::CountBits(ChildMask); }
+
+		/** Number of leaf tiles on one side of this node */
+		uint32 GetSizeInTiles() const { return 1u << Level; }
+
+		/** Min corner in leaf tiles from the tree origin */
+		uint16 TileX = 0;
+		uint16 TileY = 0;
+
+		/** Index of the first child in the node array, 0 means no children */
+		uint32 FirstChild = 0;
+
+		/** Index into the water body render data array on the tree. If this is not a leaf node, this will represent the waterbody */
+		uint16 QuadtreeMeshIndex = 0;
+
+		/** Index to the water body that this tile possibly transitions to */
+		uint16 TransitionQuadtreeMeshIndex = 0;
+
+		/** Depth from the bottom of the tree, 0 is a leaf tile */
+		uint32 Level : 5;
+
+		/** One bit per stored child, in HalfOffsets order */
+		uint32 ChildMask : 4;
+
+		/** If all 4 child nodes have a full set of leaf nodes (each descentant has 4 children all the way down) */
+		uint32 HasCompleteSubtree : 1;
+
+		/** If all descendant nodes are from the same waterbody. We can safely collapse this even if HasCompleteSubtree is false */
+		uint32 IsSubtreeSameQuadtreeMesh : 1;
+
+		/** Cached value to avoid having to visit this node's FWaterBodyRenderData */
+		uint32 HasMaterial : 1;
+
+		/** Z range quantized in ZQuantizationMax steps over the tree Z range, rounded outwards */
+		uint32 QuantizedMinZ : 10;
+		uint32 QuantizedMaxZ : 10;
+	};
+	static_assert(sizeof(FNode) == 16, "Quadtree nodes are expected to stay compact");
+
 
 	struct FNodeData
 	{
-		/** Storage for all nodes in the tree. Each node has 4 indices into this array to locate its children */
+		/** Storage for all nodes in the tree once it's read-only. Children of a node are stored contiguously */
 		TArray<FNode> Nodes;
 
+		/** Storage for all nodes while the tree is unlocked for insertion. Each node has 4 indices into this array to locate its children. Emptied when the tree is made read-only */
+		TArray<FBuildNode> BuildNodes;
+
 		/** Render data for all water bodies in this tree, indexed by the nodes */
 		TArray<FQuadtreeMeshRenderData> QuadtreeMeshRenderData;
 
 		/** Total memory dynamically allocated by this object */
-		uint32 GetAllocatedSize() const { return Nodes.GetAllocatedSize() + QuadtreeMeshRenderData.GetAllocatedSize(); }
+		uint32 GetAllocatedSize() const { return Nodes.GetAllocatedSize() + BuildNodes.GetAllocatedSize() + QuadtreeMeshRenderData.GetAllocatedSize(); }
 	} NodeData;
+
+	/** What the traversal does with a work item, see FTraversalContext::Traverse */
+	enum class ETraversalMode : uint8
+	{
+		/** Select the LOD of the node from its distance to the LOD region, the observer or the focus region */
+		SelectLOD,
+		/** The LOD is known, traverse down to the appropriate density level */
+		SelectLODRefinement,
+		/** Same as SelectLOD, but a node that would be split in finer LODs is rendered at its own LOD instead. Used for the nodes a budgeted traversal doesn't refine */
+		SelectLODCoarse,
+	};
+
+	/** 
+	 *	Traversal work item, always known to intersect the frustum. Stored nodes are referenced by index. Implicit nodes reference the stored node
+	 *	their complete subtree belongs to and inherit all its data except their tile coordinates and level.
+	 */
+	struct FTraversalItem
+	{
+		/** Index of the stored node, or of the stored node the implicit node belongs to */
+		uint32 NodeIndex;
+
+		/** Min corner and level, same meaning as on FNode */
+		uint16 TileX;
+		uint16 TileY;
+		uint8 Level;
+
+		uint8 LODLevel;
+		uint8 DensityLevel;
+		ETraversalMode Mode;
+
+		/** Frustum planes the node isn't fully inside of, only those are tested for its children. 0 means the whole subtree is visible */
+		uint32 PlaneMask;
+
+		/** Squared distance on XY to the LOD region in tile space. Only computed for SelectLOD items */
+		float SquaredDistance;
+
+		bool IsImplicit(const FNode& InNode) const { return Level != InNode.Level; }
+	};
+	static_assert(sizeof(FTraversalItem) == 20, "Traversal items are expected to stay compact");
+
+	/** Each traversal step pops one item and pushes at most 4 children, so there are never more than 3 pending siblings per level plus the last 4 children */
+	static constexpr int32 MaxTraversalStackSize = 3 * MaxTreeDepth + 4;
+
+	struct FTraversalStack
+	{
+		void Push(const FTraversalItem& InItem) { checkSlow(Num < MaxTraversalStackSize); Items[Num++] = InItem; }
+		FTraversalItem Pop() { return Items[--Num]; }
+		bool IsEmpty() const { return Num == 0; }
+
+		FTraversalItem Items[MaxTraversalStackSize];
+		int32 Num = 0;
+	};
+
+	/** Per traversal state derived once from the FTraversalDesc, so that the traversal runs in float tile space. Tile space is in leaf tiles from TileRegion.Min on XY and in world units above MinZ on Z */
+	struct FTraversalContext
+	{
+		FTraversalContext(const FMeshQuadTree& InTree, const FTraversalDesc& InTraversalDesc);
+
+		/** Make the item to start traversing from the root. Returns false if the whole tree is outside the frustum */
+		template<typename TPolicy>
+		bool MakeRootItem(FTraversalItem& OutRootItem) const;
+
+		/** 
+		 *	The traversal core. Iterates on an explicit stack starting from InRootItem until all selected nodes are added to Output. 
+		 *	Children are visited in order, so the output is the same as a depth first recursive traversal.
+		 */
+		template<typename TPolicy>
+		void Traverse(const FTraversalItem& InRootItem, FTraversalOutput& Output) const;
+
+		/**
+		 *	Traverse within TraversalDesc.InstanceBudget and VertexBudget. Nodes that the LOD distances would split are kept in a priority queue ordered by screen space error.
+		 *	The node with the largest error is split if the cost of its children still fits, otherwise it stays coarse. Costs are exact: the coarse cost of every node the queue can reach
+		 *	is counted once, in SelectLODCoarse mode, before the refinement starts.
+		 */
+		template<typename TPolicy>
+		void TraverseWithBudget(const FTraversalItem& InRootItem, FTraversalOutput& Output) const;
+
+		/** Follow the same path as the SelectLOD mode of Traverse down to InSplitDepth. Collects, in traversal order, the items that can be traversed as independent tasks */
+		template<typename TPolicy>
+		void GatherTraversalTasks(const FTraversalItem& InRootItem, int32 InSplitDepth, TArray<FTraversalItem>& OutTasks) const;
+
+		/** Children to traverse, stored or generated from a complete subtree if allowed. Returns their count */
+		int32 GetChildItems(const FTraversalItem& InItem, bool bInAllowImplicit, FTraversalItem (&OutChildren)[4]) const;
+
+		/** Cull the children of InParent and push the visible ones with the given traversal state, so that they are popped nearest to the observer first */
+		template<typename TPolicy>
+		void PushVisibleChildren(const FTraversalItem& InParent, bool bInAllowImplicit, ETraversalMode InMode, int32 InLODLevel, int32 InDensityLevel, FTraversalStack& Stack) const;
+
+		/** 
+		 *	Frustum culling of up to four items at once against the planes in InPlaneMask, one SIMD lane per item. Returns a mask with bit i set if InOutItems[i] intersects the frustum.
+		 *	Sets the plane mask of each item, and its squared distance on XY to the LOD region if bInComputeDistances is set.
+		 */
+		template<typename TPolicy>
+		uint32 CullItems4(FTraversalItem* InOutItems, int32 InItemCount, uint32 InPlaneMask, bool bInComputeDistances) const;
+
+		/**
+		 *	Clip the frustum (each of the union frusta) with the Z slab and the XY region of the tree and add the edges of its convex projection on XY as planes with no Z component.
+		 *	Tiles are flat, so testing their rectangles against these edges and the footprint bounds is a 2D separating axis test.
+		 */
+		void BuildFootprintPlanes(double InSlabHeight, double InRootSizeInTiles);
+
+		/**
+		 *	Rasterize the horizon occluders into HorizonBins: for each azimuth bin fully covered by an occluder, the lowest elevation of its top seen from the observer.
+		 *	A ray to a point further than the occluder below that elevation crosses it, since both its ends are above the bottom of the occluder.
+		 */
+		void BuildHorizon();
+
+		/** True if every point of the item is below the horizon and beyond the occluders that make it, in all the azimuth bins it covers */
+		bool IsBehindHorizon(const FTraversalItem& InItem) const;
+
+		/** Clear the bits of InVisibleMask of the items that are behind the horizon */
+		uint32 CullItemsBehindHorizon(const FTraversalItem* InItems, uint32 InVisibleMask) const;
+
+		/**
+		 *	SelectLOD for a complete subtree that has to be split. Tiles in complete subtrees only depend on their distance to the LOD region, so the tiles of each LOD ring are enumerated
+		 *	level by level from the bounds of the ring instead of walking the implicit children. Gives the same tiles as the walk, sorted back into its nearest first order.
+		 */
+		template<typename TPolicy>
+		void SelectLODInCompleteRegion(const FTraversalItem& InRegionItem, const FNode& InNode, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData, FTraversalOutput& Output) const;
+
+		/** Same condition as the SelectLOD split of Traverse, for a tile of a complete subtree at InLevel (which is also its LOD level) */
+		bool IsCompleteRegionTileSplit(int64 InTileX, int64 InTileY, int32 InLevel) const
+		{
+			return InLevel > 0 && InLevel > TraversalDesc.LowestLOD && GetSquaredDistanceToTile(InTileX, InTileY, InLevel) <= GetSquaredLODDistance(InLevel - 1);
+		}
+
+		/** Squared distance on XY from the LOD region to a tile in tile space, same as the distance computed by CullItems4 */
+		float GetSquaredDistanceToTile(int64 InTileX, int64 InTileY, int32 InLevel) const
+		{
+			const float TileSize = static_cast<float>(1u << InLevel);
+			const float DistanceX = FMath::Max(FMath::Max(static_cast<float>(InTileX) - LODRegion.Max.X, LODRegion.Min.X - (static_cast<float>(InTileX) + TileSize)), 0.0f);
+			const float DistanceY = FMath::Max(FMath::Max(static_cast<float>(InTileY) - LODRegion.Max.Y, LODRegion.Min.Y - (static_cast<float>(InTileY) + TileSize)), 0.0f);
+			return DistanceX * DistanceX + DistanceY * DistanceY;
+		}
+
+		/** Add instance for rendering this item */
+		template<typename TPolicy>
+		void AddNodeForRender(const FTraversalItem& InItem, const FNode& InNode, const FQuadtreeMeshRenderData& InQuadtreeMeshRenderData, int32 InDensityLevel, int32 InLODLevel, FTraversalOutput& Output) const;
+
+		/** Squared GetLODDistance of InLODLevel in tile space */
+		float GetSquaredLODDistance(int32 InLODLevel) const { return SquaredLODDistances[InLODLevel]; }
+
+		const FNodeData& NodeData;
+		const FTraversalDesc& TraversalDesc;
+		int32 TreeDepth = 0;
+
+		/** Frustum plane in tile space, each component replicated in all lanes */
+		struct FPlaneVectors
+		{
+			VectorRegister4Float X;
+			VectorRegister4Float Y;
+			VectorRegister4Float Z;
+			VectorRegister4Float W;
+			/** abs(X) + abs(Y), nodes have the same extent on X and Y */
+			VectorRegister4Float AbsXPlusAbsY;
+			VectorRegister4Float AbsZ;
+		};
+		TArray<FPlaneVectors, TInlineAllocator<8>> PlaneVectors;
+
+		/** One bit per plane in PlaneVectors, the plane mask of the root */
+		uint32 AllPlanesMask = 0;
+		/** The 3D frustum planes come first in PlaneVectors, followed by the footprint planes if any */
+		uint32 FrustumPlanesMask = 0;
+		uint32 FootprintPlanesMask = 0;
+		/** The frustum doesn't intersect the Z slab of the tree, nothing is visible */
+		bool bEmptyFootprint = false;
+
+		/** Horizon of one azimuth bin. Tangent is in world units of height per tile, Distance in tiles */
+		struct FHorizonBin
+		{
+			float Tangent;
+			float Distance;
+		};
+		static constexpr int32 NumHorizonBins = 256;
+		/** Empty when there are no usable occluders. Bins start at an azimuth of -PI */
+		TArray<FHorizonBin> HorizonBins;
+		/** Observer height above the bottom of the tree */
+		float HorizonObserverZ = 0.0f;
+
+		/** Observer position on XY in tile space */
+		FVector2f ObserverPosition = FVector2f::ZeroVector;
+
+		/** Region on XY in tile space the LOD distances are measured to: the observer, or TraversalDesc.TessellatedQuadtreeMeshBounds when it is valid. Replicated in all lanes */
+		FBox2f LODRegion = FBox2f(ForceInit);
+		VectorRegister4Float LODRegionMinX;
+		VectorRegister4Float LODRegionMinY;
+		VectorRegister4Float LODRegionMaxX;
+		VectorRegister4Float LODRegionMaxY;
+
+		/** Squared LOD distances in tile space, indexed by LOD level */
+		TArray<float, TInlineAllocator<MaxTreeDepth + 1>> SquaredLODDistances;
+
+		/** World size of one quantized Z step */
+		float ZStep = 0.0f;
+
+		/** Tile space to world space */
+		FVector Origin = FVector::ZeroVector;
+		double LeafSize = 0.0;
+		double MinZ = 0.0;
+	};
 };
 
 
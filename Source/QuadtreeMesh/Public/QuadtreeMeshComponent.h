@@ -10,6 +10,43 @@
 
 class FQuadtreeMeshViewExtension;
 
+/** Kind of view a quadtree mesh is rendered in, each one has its own FQuadtreeMeshViewPolicy */
+UENUM()
+enum class EQuadtreeMeshViewType : uint8
+{
+	Main,
+	SceneCapture,
+	PlanarReflection,
+	ReflectionCapture,
+	Thumbnail,
+	/** Shadow depth views, culled against the light frustum and never morphed */
+	Shadow,
+	Num UMETA(Hidden)
+};
+
+/** How the tiles of one type of view are selected */
+USTRUCT()
+struct FQuadtreeMeshViewPolicy
+{
+	GENERATED_BODY()
+
+	/** Added to the LOD bias of the view. Each step down halves the LOD distances */
+	UPROPERTY(EditAnywhere, Category = Rendering)
+	int32 LODBias = 0;
+
+	/** Finest density level the tiles render at, 0 allows the full tessellation */
+	UPROPERTY(EditAnywhere, Category = Rendering, meta = (ClampMin = "0"))
+	int32 MinDensityLevel = 0;
+
+	/** Tiles further than this from the observer on X or Y are not rendered, 0 doesn't restrict them */
+	UPROPERTY(EditAnywhere, Category = Rendering, meta = (ClampMin = "0"))
+	float BoundsExtent = 0.0f;
+
+	/** Number of frames the tiles of a view with a view state are kept before it is traversed again, 0 traverses it every frame */
+	UPROPERTY(EditAnywhere, Category = Rendering, meta = (ClampMin = "0"))
+	int32 RefreshInterval = 0;
+};
+
 
 UCLASS(Blueprintable, ClassGroup=(Rendering, Common), hidecategories=(Object,Activation,"Components|Activation"), ShowCategories=(Mobility), editinlinenew, meta=(BlueprintSpawnableComponent), MinimalAPI)
 class UQuadtreeMeshComponent : public UMeshComponent
@@ -53,6 +90,14 @@ public:
 	//void NotifyIfMeshMaterialChanged();
 	
 	void PushTessellatedQuadtreeMeshBoundsToPoxy(const FBox2D& TessellatedWaterMeshBounds)const;
+
+	/** Move the focus region, an XY box in world space. Tiles touching it are at full density and the LOD distances are measured from it instead of from the observer. Only updates the proxy, it can be called every frame */
+	void SetFocusRegion(const FBox2D& InFocusRegion);
+
+	/** Measure the LOD distances from the observer again */
+	void ClearFocusRegion() { SetFocusRegion(FBox2D(ForceInit)); }
+
+	const FBox2D& GetFocusRegion() const { return FocusRegion; }
 	
 	virtual void CollectPSOPrecacheData(const FPSOPrecacheParams& BasePrecachePSOParams, FMaterialInterfacePSOPrecacheParamsList& OutParams) override;
 
@@ -87,6 +132,8 @@ public:
 
 	int32 GetTessellationFactor() const { return FMath::Clamp(TessellationFactor, 1, 12); }
 
+	TSharedPtr<FQuadtreeMeshViewExtension> GetViewExtension() const { return QuadtreeMeshViewExtension; }
+
 private:
 	//USceneComponent interface
 	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
@@ -108,6 +155,18 @@ public:
 	UPROPERTY(EditAnywhere, Category = Rendering)
 	TObjectPtr<UMaterialInterface> MeshMaterial;
 
+	/** World space boxes hiding the tiles behind them, like terrain ridges or seawalls. Only boxes that reach down to the bottom of the mesh are used */
+	UPROPERTY(EditAnywhere, Category = Rendering)
+	TArray<FBox> HorizonOccluders;
+
+	/** LOD policy of each type of view. Secondary views can use a coarser and less frequently updated selection than the main one */
+	UPROPERTY(EditAnywhere, EditFixedSize, Category = Rendering)
+	TMap<EQuadtreeMeshViewType, FQuadtreeMeshViewPolicy> ViewPolicies;
+
+	/** Select and cull the tiles of the main views in compute shaders and draw them with indirect draws, see r.QuadtreeMesh.GPUTraversal. Shadow and ray tracing views are still traversed on the CPU */
+	UPROPERTY(EditAnywhere, Category = Rendering)
+	bool bUseGPUTraversal = false;
+
 private:
 	/** World size of the QuadtreeMesh tiles at LOD0. Multiply this with the ExtentInTiles to get the world extents of the system */
 	UPROPERTY(EditAnywhere, Category = Rendering, meta = (ClampMin = "100", AllowPrivateAcces = "true"))
@@ -127,6 +186,9 @@ private:
 
 	TSharedPtr<FQuadtreeMeshViewExtension> QuadtreeMeshViewExtension;
 
+	/** Invalid when there is no focus region */
+	FBox2D FocusRegion = FBox2D(ForceInit);
+
 	bool bNeedsRebuild = true;
 
 	bool bIsInit = true;
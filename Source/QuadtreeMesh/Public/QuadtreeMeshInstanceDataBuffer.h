@@ -1,59 +1,50 @@
 ﻿#pragma once
 
 #include "RenderingThread.h"
+#include "SceneManagement.h"
 
 
+/** Instance data streams of one GetDynamicMeshElements call, suballocated from the dynamic vertex buffer of its collector. Every call writes its own allocation, so concurrent calls never share a mapping */
 class FQuadtreeMeshInstanceDataBuffers
 {
 public:
-	static constexpr int32 NumBuffers =  3 ;
-	FQuadtreeMeshInstanceDataBuffers(int32 InInstanceCount)
-	{
-		ENQUEUE_RENDER_COMMAND(AllocateQuadtreeMeshInstanceDataBuffer)
-		(
-			[this, InInstanceCount](FRHICommandListImmediate& RHICmdList)
-			{
-				FRHIResourceCreateInfo CreateInfo(TEXT("QuadtreeMeshInstanceDataBuffers"));
-
-				int32 SizeInBytes = Align<int32>(InInstanceCount * sizeof(FVector4f), 4 * 1024);
+	/** One buffer per instance data stream, see FMeshQuadTree::NumStreams */
+	static constexpr int32 NumBuffers = WITH_EDITOR ? 2 : 1;
 
-				for (int32 i = 0; i < NumBuffers; ++i)
-				{
-					Buffer[i] = RHICmdList.CreateVertexBuffer(SizeInBytes, BUF_Dynamic, CreateInfo);
-					BufferMemory[i] = TArrayView<FVector4f>();
-				}
-			}
-		);
-	}
-	
-	~FQuadtreeMeshInstanceDataBuffers()
+	void Allocate(FGlobalDynamicVertexBuffer& InDynamicVertexBuffer, int32 InInstanceCount)
 	{
+		const uint32 SizeInBytes = InInstanceCount * sizeof(FVector4f);
+
 		for (int32 i = 0; i < NumBuffers; ++i)
 		{
-			Buffer[i].SafeRelease();
+			Allocation[i] = InDynamicVertexBuffer.Allocate(SizeInBytes);
+			check(Allocation[i].IsValid());
+			BufferMemory[i] = TArrayView<FVector4f>(reinterpret_cast<FVector4f*>(Allocation[i].Buffer), InInstanceCount);
 		}
 	}
 
-	void Lock(FRHICommandListBase& RHICmdList, int32 InInstanceCount)
+	/** Bind buffers written on the GPU instead of an allocation, see FMeshQuadTreeGPU. The streams start at the beginning of each buffer */
+	void SetExternalBuffers(FRHIBuffer* const (&InBuffers)[NumBuffers])
 	{
 		for (int32 i = 0; i < NumBuffers; ++i)
 		{
-			BufferMemory[i] = Lock(RHICmdList, InInstanceCount, i);
+			ExternalBuffers[i] = InBuffers[i];
 		}
 	}
 
-	void Unlock(FRHICommandListBase& RHICmdList)
+	FRHIBuffer* GetBuffer(int32 InBufferID) const
 	{
-		for (int32 i = 0; i < NumBuffers; ++i)
+		if (ExternalBuffers[InBufferID])
 		{
-			Unlock(RHICmdList, i);
-			BufferMemory[i] = TArrayView<FVector4f>();
+			return ExternalBuffers[InBufferID];
 		}
+		return Allocation[InBufferID].VertexBuffer ? Allocation[InBufferID].VertexBuffer->VertexBufferRHI.GetReference() : nullptr;
 	}
 
-	FBufferRHIRef GetBuffer(int32 InBufferID) const
+	/** Offset in bytes of the allocation in the buffer */
+	uint32 GetBufferOffset(int32 InBufferID) const
 	{
-		return Buffer[InBufferID];
+		return ExternalBuffers[InBufferID] ? 0 : Allocation[InBufferID].VertexOffset;
 	}
 
 	TArrayView<FVector4f> GetBufferMemory(int32 InBufferID) const
@@ -64,32 +55,7 @@ public:
 
 	
 private:
-	
-	TArrayView<FVector4f> Lock(FRHICommandListBase& RHICmdList, int32 InInstanceCount, int32 InBufferID)
-	{
-		uint32 SizeInBytes = InInstanceCount * sizeof(FVector4f);
-
-		if (SizeInBytes > Buffer[InBufferID]->GetSize())
-		{
-			Buffer[InBufferID].SafeRelease();
-
-			FRHIResourceCreateInfo CreateInfo(TEXT("QuadtreeMeshInstanceDataBuffers"));
-
-			// Align size in to avoid reallocating for a few differences of instance count
-			uint32 AlignedSizeInBytes = Align<uint32>(SizeInBytes, 4 * 1024);
-
-			Buffer[InBufferID] = RHICmdList.CreateVertexBuffer(AlignedSizeInBytes, BUF_Dynamic, CreateInfo);
-		}
-
-		FVector4f* Data = reinterpret_cast<FVector4f*>(RHICmdList.LockBuffer(Buffer[InBufferID], 0, SizeInBytes, RLM_WriteOnly));
-		return TArrayView<FVector4f>(Data, InInstanceCount);
-	}
-
-	void Unlock(FRHICommandListBase& RHICmdList, int32 InBufferID)
-	{
-		RHICmdList.UnlockBuffer(Buffer[InBufferID]);
-	}
-
-	FBufferRHIRef Buffer[NumBuffers];
+	FGlobalDynamicVertexBuffer::FAllocation Allocation[NumBuffers];
 	TArrayView<FVector4f> BufferMemory[NumBuffers];
+	FRHIBuffer* ExternalBuffers[NumBuffers] = {};
 };
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "QuadtreeMeshSceneInfo.h"
 #include "SceneViewExtension.h"
 
+class FQuadtreeMeshSceneProxy;
+
 class FQuadtreeMeshViewExtension : public FWorldSceneViewExtension
 {
 	public:
@@ -17,8 +19,12 @@ class FQuadtreeMeshViewExtension : public FWorldSceneViewExtension
 	virtual void PreRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily) override;
 	// End FSceneViewExtensionBase implementation
 
+	void AddSceneProxy_RenderThread(FQuadtreeMeshSceneProxy* InSceneProxy);
+	void RemoveSceneProxy_RenderThread(FQuadtreeMeshSceneProxy* InSceneProxy);
+
 private:
-	
+	/** Proxies of the world whose traversal is launched ahead of GetDynamicMeshElements. Only accessed on the render thread */
+	TArray<FQuadtreeMeshSceneProxy*> SceneProxies;
 };
 
 
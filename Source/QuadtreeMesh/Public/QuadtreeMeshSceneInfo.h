@@ -4,6 +4,8 @@
 #include "QuadtreeMeshComponent.h"
 #include "UObject/WeakObjectPtrTemplates.h"
 
+class UTextureRenderTarget2D;
+
 namespace UE::QuadtreeMeshInfo
 {
 	struct FRenderingContext
@@ -1,10 +1,14 @@
 ﻿#pragma once
 #include "MeshQuadTree.h"
+#include "FMeshQuadTreeGPU.h"
+#include "QuadtreeMeshComponent.h"
 #include "Materials/MaterialInterface.h"
 #include "PrimitiveSceneProxy.h"
 #include "QuadtreeMeshVertexFactory.h"
 #include "Materials/MaterialRelevance.h"
 #include "RayTracingGeometry.h"
+#include "Tasks/Task.h"
+#include <atomic>
 
 
 struct FRayTracingMaterialGatheringContext;
@@ -20,6 +24,7 @@ public:
 	virtual ~FQuadtreeMeshSceneProxy()override;
 
 	virtual void CreateRenderThreadResources(FRHICommandListBase& RHICmdList) override;
+	virtual void DestroyRenderThreadResources() override;
 
 	virtual uint32 GetMemoryFootprint() const override
 	{
@@ -28,7 +33,7 @@ public:
 
 	uint32 GetAllocatedSize() const 
 	{
-		return(FPrimitiveSceneProxy::GetAllocatedSize() + (QuadtreeMeshVertexFactories.GetAllocatedSize() + QuadtreeMeshVertexFactories.Num() * sizeof(FQuadtreeMeshVertexFactory)) + MeshQuadTree.GetAllocatedSize());
+		return(FPrimitiveSceneProxy::GetAllocatedSize() + (QuadtreeMeshVertexFactories.GetAllocatedSize() + QuadtreeMeshVertexFactories.Num() * sizeof(FQuadtreeMeshVertexFactory)) + MeshQuadTree.GetAllocatedSize() + QuadTreeGPU.GetAllocatedSize());
 	}
 
 	virtual bool CanBeOccluded() const override
@@ -40,8 +45,15 @@ public:
 
 	virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View) const override;
 
+	/** Set by the renderer around the GetDynamicMeshElements calls of shadow depth views */
+	virtual void SetDynamicMeshElementsShadowCullFrustum(const FConvexVolume* InShadowCullFrustum) override { ShadowCullFrustum = InShadowCullFrustum; }
+	virtual const FConvexVolume* GetDynamicMeshElementsShadowCullFrustum() const override { return ShadowCullFrustum; }
+
 	void OnTessellatedQuadtreeMeshBoundsChanged_GameThread(const FBox2D& InTessellatedWaterMeshBounds);
 
+	/** Start traversing the quadtree for the views of InViewFamily the primitive is shown in, GetDynamicMeshElements then waits for the result instead of traversing. GPU trees add their traversals to GraphBuilder */
+	void LaunchAsyncViewTraversals_RenderThread(FRDGBuilder& GraphBuilder, const FSceneViewFamily& InViewFamily);
+
 	
 
 #if WITH_EDITOR
@@ -71,17 +83,126 @@ private:
 	};
 	
 	void SetupRayTracingInstances(FRHICommandListBase& RHICmdList, int32 NumInstances, uint32 DensityIndex);
-	
-	void OnTessellatedQuadtreeMeshBoundsChanged_RenderThread(const FBox2D& InTessellatedWaterMeshBounds);
 
 #endif
 
+	void OnTessellatedQuadtreeMeshBoundsChanged_RenderThread(const FBox2D& InTessellatedWaterMeshBounds);
+
 	bool HasQuadtreeData() const 
 	{
 		return MeshQuadTree.GetNodeCount() != 0 && DensityCount != 0;
 	}
 
-	FQuadtreeMeshLODParams GetQuadtreeMeshLODParams(const FVector& Position) const;
+	FQuadtreeMeshLODParams GetQuadtreeMeshLODParams(const FVector& Position, float InLODScale) const;
+
+	/** Traversal of one view kept from one frame to the next, so that it can be reused while the view barely moves */
+	struct FCachedViewTraversal
+	{
+		FMeshQuadTree::FTraversalOutput Output;
+		/** Frustum planes the traversal was culled with, pushed out by the reuse margin */
+		TArray<FPlane, TInlineAllocator<6>> CullingPlanes;
+		FVector ObserverPosition = FVector::ZeroVector;
+		FBox2D TessellatedQuadtreeMeshBounds = FBox2D(ForceInit);
+		int32 LowestLOD = 0;
+		int32 LODBias = 0;
+		int32 ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+		int32 MinDensityLevel = 0;
+		uint32 TraversedFrameNumber = 0;
+		uint32 LastUsedFrameNumber = 0;
+	};
+
+	/** Traversal parameters and results of the views of one GetDynamicMeshElements call, one entry per traversed view */
+	struct FViewTraversals
+	{
+		TArray<FMeshQuadTree::FTraversalDesc, TInlineAllocator<4>> TraversalDescPerView;
+		TArray<FMeshQuadTree::FTraversalOutput, TInlineAllocator<4>> QuadtreeMeshInstanceDataPerView;
+		/** Index of the traversed view in the view family */
+		TArray<int32, TInlineAllocator<4>> ViewIndexPerTraversal;
+		/** Views with a view state can reuse their traversal of a previous frame. 0 when the view can't */
+		TArray<uint32, TInlineAllocator<4>> ViewKeyPerTraversal;
+		/** Number of frames a traversal can be reused for regardless of how much its view moved */
+		TArray<uint32, TInlineAllocator<4>> RefreshIntervalPerTraversal;
+		double TraversalReuseMargin = 0.0;
+		/** Negative when the views don't share traversals */
+		double SharedTraversalMaxObserverDistance = -1.0;
+		bool bParallelViewTraversal = false;
+		bool bEncounteredISRView = false;
+		/** Set instead of QuadtreeMeshInstanceDataPerView when the views were traversed on the GPU, one per traversal */
+		TArray<FMeshQuadTreeGPU::FTraversalResult, TInlineAllocator<4>> GPUTraversalResultPerView;
+		/** The views are traversed by FMeshQuadTreeGPU::Emulate, with descs made by FMeshQuadTreeGPU::MakeGPUTraversalDesc */
+		bool bEmulateGPUTraversal = false;
+		int32 GPUTraversalBucketCapacity = 0;
+		int32 InstanceFactor = 1;
+		uint32 FrameNumber = 0;
+	};
+
+	/** Fill the traversal descs of the views in VisibilityMap. Render thread only, this is where the console variables are read */
+	void SetupViewTraversals(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector* Collector, FViewTraversals& Out) const;
+
+	/** Traverse the quadtree for the views set up in InOut, reusing and sharing traversals where possible. Can run on any thread */
+	void TraverseViews(FViewTraversals& InOut) const;
+
+	/** Whether the views of this proxy can be traversed in compute shaders. Render thread only */
+	bool UseGPUTraversal() const;
+
+	/** Add the GPU traversals of the views set up in InOut to GraphBuilder. Returns false, without changing InOut, if one of the views has to be traversed on the CPU */
+	bool TraverseViewsOnGPU(FRDGBuilder& GraphBuilder, FViewTraversals& InOut);
+
+	/** Waits for the traversals launched ahead. Returns true and moves the traversals of the visible views to Out if one was launched for this view family */
+	bool ConsumeAsyncViewTraversals(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FViewTraversals& Out) const;
+
+	/** Traversal launched by the view extension when a view family starts rendering */
+	struct FAsyncViewTraversals
+	{
+		UE::Tasks::FTask Task;
+		const FSceneViewFamily* ViewFamily = nullptr;
+		TArray<const FSceneView*, TInlineAllocator<4>> Views;
+		/** Bit per view of Views, set for the views the primitive is shown in */
+		uint32 TraversedViewMap = 0;
+		TSharedRef<FViewTraversals> Traversals = MakeShared<FViewTraversals>();
+	};
+
+	/** Returns true if InCachedTraversal selects the same tiles as a new traversal with InTraversalDesc would, up to InMargin world units of observer movement */
+	bool CanReuseViewTraversal(const FCachedViewTraversal& InCachedTraversal, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, double InMargin) const;
+
+	/** Copy the cached traversal to Output, patching the height morph that follows the exact observer height */
+	static void CopyCachedViewTraversal(const FCachedViewTraversal& InCachedTraversal, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, FMeshQuadTree::FTraversalOutput& Output);
+
+	/** Returns true if both views select the same tiles up to their frustum, so that they can share one traversal against the union of their frusta */
+	static bool CanShareViewTraversal(const FMeshQuadTree::FTraversalDesc& InTraversalDescA, const FMeshQuadTree::FTraversalDesc& InTraversalDescB, double InMaxObserverDistance);
+
+	/** Keep the tiles of a shared traversal that are inside the frustum of one of its views, with the height morph of that view */
+	void FilterSharedViewTraversal(const FMeshQuadTree::FTraversalOutput& InSharedOutput, const FMeshQuadTree::FTraversalDesc& InTraversalDesc, FMeshQuadTree::FTraversalOutput& Output) const;
+
+	/** State of the adaptive LOD controller. The cost of a frame is accumulated over its GetDynamicMeshElements calls and evaluated at the start of the next frame */
+	struct FAdaptiveLODState
+	{
+		/** Smoothed LOD bias, only applied once it drifts far enough from AppliedLODBias */
+		float LODBias = 0.0f;
+		int32 AppliedLODBias = 0;
+		/** Collapse level forced on top of the one of the component, Max when the controller doesn't force any */
+		int32 ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+		/** Consecutive frames spent over (positive) or under (negative) the target while the LOD bias was at its limit */
+		int32 FramesAtLODBiasLimit = 0;
+		uint32 FrameNumber = INDEX_NONE;
+		/** Added to by every GetDynamicMeshElements call and traversal task of the frame */
+		std::atomic<int64> VertexCount = 0;
+		std::atomic<uint64> TraversalCycles = 0;
+
+		void Reset()
+		{
+			LODBias = 0.0f;
+			AppliedLODBias = 0;
+			ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
+			FramesAtLODBiasLimit = 0;
+			FrameNumber = INDEX_NONE;
+			VertexCount = 0;
+			TraversalCycles = 0;
+		}
+	};
+
+	/** Evaluate the cost of the previous frame and update the adaptive LOD bias and collapse level, once per frame */
+	void UpdateAdaptiveLOD(uint32 InFrameNumber) const;
 	
 	FMaterialRelevance MaterialRelevance;
 
@@ -91,26 +212,50 @@ private:
 	/** Tiles containing water, stored in a quad tree */
 	FMeshQuadTree MeshQuadTree;
 
-	/** Unique Instance data buffer shared accross water batch draw calls */	
-	FQuadtreeMeshInstanceDataBuffers* QuadtreeMeshInstanceDataBuffers;
-
-	/** Per-"water render group" user data (the number of groups might vary depending on whether we're in the editor or not) */
-	FQuadtreeMeshUserDataBuffers* QuadtreeMeshUserDataBuffers;
-
+	/** Focus region of the component, moved without recreating the proxy */
 	FBox2D TessellatedQuadtreeMeshBounds = FBox2D(ForceInit);
 
 	uint32 SceneProxyCreatedFrameNumberRenderThread = INDEX_NONE;
 
 	int32 ForceCollapseDensityLevel = TNumericLimits<int32>::Max();
 
+	FQuadtreeMeshViewPolicy ViewPolicies[static_cast<int32>(EQuadtreeMeshViewType::Num)];
+
+	TArray<FBox> HorizonOccluders;
+
+	/** Light frustum of the shadow depth view being gathered, null for the other views */
+	const FConvexVolume* ShadowCullFrustum = nullptr;
+
 	float LODScale = -1.0f;
 
 	int32 DensityCount = 0;
 
+	/** Quads per tile side at the highest density */
+	int32 NumQuadsPerTileSide = 0;
+
 	double MeshQuadTreeMinHeight = DBL_MAX;
 	double MeshQuadTreeMaxHeight = -DBL_MAX;
 
-	mutable int32 HistoricalMaxViewInstanceCount = 0;
+	mutable std::atomic<int32> HistoricalMaxViewInstanceCount = 0;
+
+	mutable FAdaptiveLODState AdaptiveLOD;
+	/** Makes the once per frame update of the controller happen in only one of concurrent GetDynamicMeshElements calls */
+	mutable FCriticalSection AdaptiveLODCriticalSection;
+
+	/** Last traversal of each view with a view state, keyed by the view key */
+	mutable TMap<uint32, FCachedViewTraversal> CachedViewTraversals;
+	/** Only held while looking up and storing traversals, not while traversing */
+	mutable FCriticalSection CachedViewTraversalsCriticalSection;
+
+	/** Traversals launched ahead of GetDynamicMeshElements for the view families of the current frame */
+	mutable TArray<FAsyncViewTraversals, TInlineAllocator<1>> AsyncViewTraversals;
+	mutable FCriticalSection AsyncViewTraversalsCriticalSection;
+
+	/** Nodes and output buffers of the GPU traversals, render thread only */
+	FMeshQuadTreeGPU QuadTreeGPU;
+
+	/** Launches the asynchronous traversals, the proxy registers with it on the render thread */
+	TSharedPtr<FQuadtreeMeshViewExtension> ViewExtension;
 
 	bool bIsVisble;
 
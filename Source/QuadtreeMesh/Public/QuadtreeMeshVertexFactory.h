@@ -7,15 +7,19 @@
 BEGIN_GLOBAL_SHADER_PARAMETER_STRUCT(FQuadtreeMeshVertexFactoryParameters, )
 	SHADER_PARAMETER(float, LODScale)
 	SHADER_PARAMETER(int32, NumQuadsPerTileSide)
+	SHADER_PARAMETER(FVector3f, TreeOriginHigh)
+	SHADER_PARAMETER(float, LeafSize)
+	SHADER_PARAMETER(FVector3f, TreeOriginLow)
 	SHADER_PARAMETER(int32, bRenderSelected)
 	SHADER_PARAMETER(int32, bRenderUnselected)
+	SHADER_PARAMETER(FVector4f, FocusRegion)
+	SHADER_PARAMETER(int32, bHasFocusRegion)
 END_GLOBAL_SHADER_PARAMETER_STRUCT()
 using FQuadtreeMeshVertexFactoryBufferRef = TUniformBufferRef<FQuadtreeMeshVertexFactoryParameters>;
 
 BEGIN_GLOBAL_SHADER_PARAMETER_STRUCT(FQuadtreeMeshVertexFactoryRaytracingParameters, )
 	SHADER_PARAMETER_SRV(Buffer<float>, VertexBuffer)
 	SHADER_PARAMETER(FVector4f, InstanceData0)
-	SHADER_PARAMETER(FVector4f, InstanceData1)
 END_GLOBAL_SHADER_PARAMETER_STRUCT()
 using FQuadtreeMeshVertexFactoryRaytracingParametersRef = TUniformBufferRef<FQuadtreeMeshVertexFactoryRaytracingParameters>;
 
@@ -158,7 +162,8 @@ public:
 	static constexpr int32 NumRenderGroups =  3 ; // Must match EWaterMeshRenderGroupType
 	static constexpr int32 NumAdditionalVertexStreams = FQuadtreeMeshInstanceDataBuffers::NumBuffers;
 	
-	FQuadtreeMeshVertexFactory(ERHIFeatureLevel::Type InFeatureLevel, int32 InNumQuadsPerSide,	float InLODScale);
+	/** Instances are placed in leaf tiles of InLeafSize from InTreeOrigin, see FMeshQuadTree::FTraversalOutput. Vertices morph by their distance to InFocusRegion when it is valid, like the traversal selects LODs */
+	FQuadtreeMeshVertexFactory(ERHIFeatureLevel::Type InFeatureLevel, int32 InNumQuadsPerSide, float InLODScale, float InLeafSize, const FVector& InTreeOrigin, const FBox2D& InFocusRegion);
 	~FQuadtreeMeshVertexFactory();
 
 	virtual void InitRHI(FRHICommandListBase& RHICmdList) override;
@@ -175,6 +180,9 @@ public:
 	
 	const FUniformBufferRHIRef GeFQuadtreeMeshVertexFactoryUniformBuffer(EQuadtreeMeshRenderGroupType InRenderGroupType) const { return UniformBuffers[static_cast<int32>(InRenderGroupType)]; }
 
+	/** Render thread only. Recreates the uniform buffers once initialized */
+	void SetFocusRegion(const FBox2D& InFocusRegion);
+
 private:
 	void SetupUniformDataForGroup(EQuadtreeMeshRenderGroupType InRenderGroupType);
 
@@ -187,6 +195,10 @@ private:
 
 	const int32 NumQuadsPerSide = 0;
 	const float LODScale = 0.0f;
+	const float LeafSize = 0.0f;
+	const FVector TreeOrigin = FVector::ZeroVector;
+	/** XY box in world space, invalid when there is no focus region */
+	FBox2D FocusRegion = FBox2D(ForceInit);
 };
 
 